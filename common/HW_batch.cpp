@@ -0,0 +1,440 @@
+#include "IP.h"
+#include "HW_batch.h"
+#include "HW_histogram.h"
+#include "HW_parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+using namespace IP;
+
+void HW_blurIntegral(ImagePtr, int, int, ImagePtr);
+void HW_adaptiveThreshold(ImagePtr, int, int, double, ImagePtr);
+int  HW_thresholdOtsu(ImagePtr, ImagePtr);
+void HW_thresholdMultiOtsu(ImagePtr, int, ImagePtr);
+void HW_histoStretchAuto(ImagePtr, double, double, ImagePtr);
+void HW_quantizeAdaptive(ImagePtr, int, ImagePtr);
+void HW_erode(ImagePtr, int, int, ImagePtr);
+void HW_dilate(ImagePtr, int, int, ImagePtr);
+void HW_open(ImagePtr, int, int, ImagePtr);
+void HW_close(ImagePtr, int, int, ImagePtr);
+void HW_tophat(ImagePtr, int, int, ImagePtr);
+void HW_resize(ImagePtr, int, int, int, ImagePtr);
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// chain operators
+//
+
+namespace {
+
+struct BatchOp {
+    const char* name;
+    const char* args;           // argument names for the usage text
+    std::vector<double> defaults;
+    bool window;                // one size given: use it for both dimensions
+    HW_Batch::Op fn;
+};
+
+const std::vector<BatchOp>& batchOps() {
+    static const std::vector<BatchOp> ops = {
+        { "resize", "w,h,method", { 512, 0, 0 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_resize(I, (int)a[0], (int)a[1], (int)a[2], O); } },
+        { "threshold", "thr", { 128 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_threshold(I, (int)a[0], O); } },
+        { "thresholdOtsu", "", {}, false,
+          [](ImagePtr I, const double*, ImagePtr O) { HW_thresholdOtsu(I, O); } },
+        { "thresholdMultiOtsu", "levels", { 3 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_thresholdMultiOtsu(I, (int)a[0], O); } },
+        { "adaptiveThreshold", "method,size,k", { 0, 15, 0.15 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_adaptiveThreshold(I, (int)a[0], (int)a[1], a[2], O); } },
+        { "clip", "t1,t2", { 0, MaxGray }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_clip(I, (int)a[0], (int)a[1], O); } },
+        { "quantize", "levels,dither", { 8, 0 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_quantize(I, (int)a[0], a[1] != 0, O); } },
+        { "quantizeAdaptive", "levels", { 8 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_quantizeAdaptive(I, (int)a[0], O); } },
+        { "gamma", "gamma", { 1.0 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_gammaCorrect(I, a[0], O); } },
+        { "contrast", "brightness,contrast", { 0, 1.0 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_contrast(I, a[0], a[1], O); } },
+        { "histoStretch", "t1,t2", { 0, MaxGray }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_histoStretch(I, (int)a[0], (int)a[1], O); } },
+        { "histoStretchAuto", "loPct,hiPct", { 1, 99 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_histoStretchAuto(I, a[0], a[1], O); } },
+        { "errDiffusion", "method,serpentine,gamma", { 0, 1, 1.0 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_errDiffusion(I, (int)a[0], a[1] != 0, a[2], O); } },
+        { "blur", "w,h", { 3, 3 }, true,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_blur(I, (int)a[0], (int)a[1], O); } },
+        { "blurIntegral", "w,h", { 3, 3 }, true,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_blurIntegral(I, (int)a[0], (int)a[1], O); } },
+        { "sharpen", "size,factor", { 3, 1.0 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_sharpen(I, (int)a[0], a[1], O); } },
+        { "median", "size", { 3 }, false,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_median(I, (int)a[0], O); } },
+        { "erode", "w,h", { 3, 3 }, true,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_erode(I, (int)a[0], (int)a[1], O); } },
+        { "dilate", "w,h", { 3, 3 }, true,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_dilate(I, (int)a[0], (int)a[1], O); } },
+        { "open", "w,h", { 3, 3 }, true,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_open(I, (int)a[0], (int)a[1], O); } },
+        { "close", "w,h", { 3, 3 }, true,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_close(I, (int)a[0], (int)a[1], O); } },
+        { "tophat", "w,h", { 9, 9 }, true,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_tophat(I, (int)a[0], (int)a[1], O); } },
+    };
+    return ops;
+}
+
+std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t");
+    size_t e = s.find_last_not_of(" \t");
+    return (b == std::string::npos) ? std::string() : s.substr(b, e - b + 1);
+}
+
+// output file names in outDir: the input base names, with "-2", "-3", ...
+// before the extension for inputs whose base name was taken by an earlier one
+std::vector<std::string> outputNames(const std::vector<std::string>& files, const std::string& outDir) {
+    std::vector<std::string> names;
+    std::set<std::string> used;
+    for (const std::string& in : files) {
+        const size_t slash = in.find_last_of("/\\");
+        const std::string base = (slash == std::string::npos) ? in : in.substr(slash + 1);
+        std::string name = base;
+        for (int k = 2; !used.insert(name).second; ++k) {
+            const size_t dot = base.find_last_of('.');
+            const std::string stem = (dot == std::string::npos || dot == 0) ? base : base.substr(0, dot);
+            const std::string ext = (stem.size() == base.size()) ? std::string() : base.substr(dot);
+            name = stem + "-" + std::to_string(k) + ext;
+        }
+        if (name != base)
+            fprintf(stderr, "HW_Batch: %s: %s is taken, writing %s\n", in.c_str(), base.c_str(), name.c_str());
+        names.push_back(outDir + "/" + name);
+    }
+    return names;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsedMs(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// a loaded image on its way through the pool
+struct Task {
+    int index;
+    ImagePtr image;
+};
+
+// worker deque: the owner pops at the front, thieves take from the back
+struct WorkQueue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+};
+
+} // namespace
+
+void HW_batchUsage(FILE* fp) {
+    fprintf(fp, "operators (name:args, defaults in brackets):\n");
+    for (const BatchOp& op : batchOps()) {
+        fprintf(fp, "  %-20s %-26s [", op.name, op.args);
+        for (size_t i = 0; i < op.defaults.size(); ++i)
+            fprintf(fp, "%s%g", i ? "," : "", op.defaults[i]);
+        fprintf(fp, "]\n");
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// input files
+//
+
+int HW_batchCollect(const std::vector<std::string>& paths, std::vector<std::string>& files) {
+    int errors = 0;
+    for (const std::string& path : paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            errors++;
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            files.push_back(path);
+            continue;
+        }
+
+        DIR* dir = opendir(path.c_str());
+        if (!dir) {
+            errors++;
+            continue;
+        }
+        std::vector<std::string> names;
+        while (struct dirent* e = readdir(dir)) {
+            if (e->d_name[0] == '.') continue;
+            std::string file = path + "/" + e->d_name;
+            if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)) names.push_back(file);
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        files.insert(files.end(), names.begin(), names.end());
+    }
+    return errors;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_Batch
+//
+
+HW_Batch::HW_Batch(int threads, long long largePixels)
+    : m_threads(threads), m_largePixels(largePixels),
+      m_wallMs(0.0), m_readMs(0.0), m_writeMs(0.0), m_images(0), m_failed(0), m_steals(0) {}
+
+bool HW_Batch::setChain(const std::string& spec, std::string& error) {
+    std::vector<Step> chain;
+    size_t pos = 0;
+    while (pos <= spec.size()) {
+        size_t bar = spec.find('|', pos);
+        if (bar == std::string::npos) bar = spec.size();
+        const std::string text = trim(spec.substr(pos, bar - pos));
+        pos = bar + 1;
+
+        const size_t colon = text.find(':');
+        const std::string name = trim(text.substr(0, colon));
+        const BatchOp* op = nullptr;
+        for (const BatchOp& o : batchOps())
+            if (name == o.name) op = &o;
+        if (!op) {
+            error = "unknown operator '" + name + "'";
+            return false;
+        }
+
+        Step step = { text, op->defaults, op->fn };
+        if (colon != std::string::npos) {
+            const std::string list = text.substr(colon + 1);
+            size_t p = 0, n = 0;
+            while (p <= list.size()) {
+                size_t comma = list.find(',', p);
+                if (comma == std::string::npos) comma = list.size();
+                const std::string arg = trim(list.substr(p, comma - p));
+                p = comma + 1;
+
+                char* end = nullptr;
+                const double v = std::strtod(arg.c_str(), &end);
+                if (arg.empty() || *end) {
+                    error = "bad argument '" + arg + "' in '" + text + "'";
+                    return false;
+                }
+                if (n >= step.args.size()) {
+                    error = "too many arguments in '" + text + "'";
+                    return false;
+                }
+                step.args[n++] = v;
+            }
+            if (op->window && n == 1) step.args[1] = step.args[0];
+        }
+        chain.push_back(step);
+    }
+
+    m_chain.swap(chain);
+    return true;
+}
+
+int HW_Batch::run(const std::vector<std::string>& files, const std::string& outDir) {
+    const int threads = (m_threads > 0) ? m_threads : HW_threadCount();
+    const int inFlightMax = 2 * threads;
+
+    mkdir(outDir.c_str(), 0777);        // may exist already
+    const std::vector<std::string> outputs = outputNames(files, outDir);
+
+    std::vector<WorkQueue> queues(threads);
+    std::atomic<int> queued(0), busy(0);
+    std::atomic<long long> steals(0), failed(0);
+    bool readerDone = false;
+    std::mutex wakeLock;
+    std::condition_variable wake;
+
+    // images read but not written, bounded by inFlightMax
+    int inFlight = 0;
+    std::mutex flowLock;
+    std::condition_variable flow;
+
+    std::deque<Task> written;
+    std::mutex writeLock;
+    std::condition_variable writeReady;
+
+    m_readMs = m_writeMs = 0.0;
+    Clock::time_point start = Clock::now();
+
+    // reader: deal the images round-robin to the worker deques
+    std::thread reader([&]() {
+        for (int i = 0; i < (int)files.size(); ++i) {
+            {
+                std::unique_lock<std::mutex> lk(flowLock);
+                flow.wait(lk, [&]() { return inFlight < inFlightMax; });
+                inFlight++;
+            }
+            Clock::time_point t0 = Clock::now();
+            ImagePtr I = IP_readImage(files[i].c_str());
+            m_readMs += elapsedMs(t0);
+            if (I.isNull()) {
+                fprintf(stderr, "HW_Batch: cannot read %s\n", files[i].c_str());
+                failed++;
+                std::lock_guard<std::mutex> lk(flowLock);
+                inFlight--;
+                continue;
+            }
+
+            WorkQueue& q = queues[i % threads];
+            {
+                std::lock_guard<std::mutex> lk(q.lock);
+                q.tasks.push_back(Task{ i, I });
+            }
+            std::lock_guard<std::mutex> lk(wakeLock);
+            queued++;
+            wake.notify_one();
+        }
+        std::lock_guard<std::mutex> lk(wakeLock);
+        readerDone = true;
+        wake.notify_all();
+    });
+
+    // writer: save results in completion order
+    std::thread writer([&]() {
+        for (;;) {
+            Task t;
+            {
+                std::unique_lock<std::mutex> lk(writeLock);
+                writeReady.wait(lk, [&]() { return !written.empty(); });
+                t = written.front();
+                written.pop_front();
+            }
+            if (t.index < 0) break;
+
+            const std::string& out = outputs[t.index];
+            Clock::time_point t0 = Clock::now();
+            if (!IP_saveImage(t.image, out.c_str(), "default")) {
+                fprintf(stderr, "HW_Batch: cannot write %s\n", out.c_str());
+                failed++;
+            }
+            m_writeMs += elapsedMs(t0);
+
+            std::lock_guard<std::mutex> lk(flowLock);
+            inFlight--;
+            flow.notify_one();
+        }
+    });
+
+    // take from the own deque first, then steal from the back of the others
+    auto take = [&](int k, Task& t) {
+        for (int j = 0; j < threads; ++j) {
+            WorkQueue& q = queues[(k + j) % threads];
+            std::lock_guard<std::mutex> lk(q.lock);
+            if (q.tasks.empty()) continue;
+            if (j == 0) {
+                t = q.tasks.front();
+                q.tasks.pop_front();
+            }
+            else {
+                t = q.tasks.back();
+                q.tasks.pop_back();
+                steals++;
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    };
+
+    std::vector<std::vector<HW_BatchStageStats>> stats(threads);
+    const HW_HistogramSampling sampling = HW_histogramSampling();
+    auto worker = [&](int k) {
+        std::vector<HW_BatchStageStats>& st = stats[k];
+        HW_histogramSampling() = sampling;
+        for (const Step& s : m_chain) st.push_back(HW_BatchStageStats{ s.name, 0, 0.0, 0.0 });
+
+        for (;;) {
+            Task t;
+            if (!take(k, t)) {
+                std::unique_lock<std::mutex> lk(wakeLock);
+                if (queued == 0 && readerDone) break;
+                wake.wait(lk, [&]() { return queued > 0 || readerDone; });
+                continue;
+            }
+
+            // large images share the threads that have no image of their own
+            const int active = ++busy;
+            const long long pixels = (long long)t.image->width() * t.image->height();
+            int budget = 1;
+            if (pixels >= m_largePixels) budget = std::max(1, (threads - queued) / active);
+            HW_threadBudget() = budget;
+
+            ImagePtr cur = t.image;
+            for (size_t s = 0; s < m_chain.size(); ++s) {
+                ImagePtr out;
+                Clock::time_point t0 = Clock::now();
+                m_chain[s].fn(cur, m_chain[s].args.data(), out);
+                const double ms = elapsedMs(t0);
+                st[s].images++;
+                st[s].busyMs += ms;
+                if (ms > st[s].maxMs) st[s].maxMs = ms;
+                cur = out;
+            }
+            busy--;
+
+            std::lock_guard<std::mutex> lk(writeLock);
+            written.push_back(Task{ t.index, cur });
+            writeReady.notify_one();
+        }
+        HW_threadBudget() = 0;
+    };
+
+    std::vector<std::thread> workers;
+    for (int k = 1; k < threads; ++k) workers.emplace_back(worker, k);
+    worker(0);
+    for (std::thread& w : workers) w.join();
+    reader.join();
+    {
+        std::lock_guard<std::mutex> lk(writeLock);
+        written.push_back(Task{ -1, ImagePtr() });
+        writeReady.notify_one();
+    }
+    writer.join();
+    m_wallMs = elapsedMs(start);
+
+    // merge the per-worker statistics
+    m_stats.clear();
+    for (const Step& s : m_chain) m_stats.push_back(HW_BatchStageStats{ s.name, 0, 0.0, 0.0 });
+    for (int k = 0; k < threads; ++k)
+        for (size_t s = 0; s < stats[k].size(); ++s) {
+            m_stats[s].images += stats[k][s].images;
+            m_stats[s].busyMs += stats[k][s].busyMs;
+            m_stats[s].maxMs = std::max(m_stats[s].maxMs, stats[k][s].maxMs);
+        }
+    m_failed = failed;
+    m_steals = steals;
+    m_images = (long long)files.size() - m_failed;
+    return (int)m_images;
+}
+
+void HW_Batch::report(FILE* fp) const {
+    double computeMs = 0.0;
+    for (const HW_BatchStageStats& st : m_stats) computeMs += st.busyMs;
+
+    fprintf(fp, "%-28s %8s %10s %9s %9s %6s\n", "stage", "images", "total ms", "mean ms", "max ms", "share");
+    for (const HW_BatchStageStats& st : m_stats) {
+        const double mean = st.images ? st.busyMs / st.images : 0.0;
+        const double share = (computeMs > 0.0) ? 100.0 * st.busyMs / computeMs : 0.0;
+        fprintf(fp, "%-28s %8lld %10.1f %9.2f %9.2f %5.1f%%\n",
+                st.name.c_str(), st.images, st.busyMs, mean, st.maxMs, share);
+    }
+    fprintf(fp, "%-28s %8s %10.1f\n", "read (reader thread)", "", m_readMs);
+    fprintf(fp, "%-28s %8s %10.1f\n", "write (writer thread)", "", m_writeMs);
+
+    fprintf(fp, "%lld images in %.1f ms: %.2f images/s", m_images, m_wallMs,
+            (m_wallMs > 0.0) ? 1000.0 * m_images / m_wallMs : 0.0);
+    fprintf(fp, " (%lld failed, %lld steals)\n", m_failed, m_steals);
+}
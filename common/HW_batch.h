@@ -0,0 +1,93 @@
+#ifndef HW_BATCH_H
+#define HW_BATCH_H
+
+#include "IP.h"
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_Batch:
+//
+// Batch driver that applies a chain of HW_* operators to many image files
+// (see tools/hwbatch.cpp for the command-line front end).
+//
+// A chain spec lists operators separated by '|', each optionally followed
+// by ':' and comma-separated arguments in the order of the HW_* function:
+//   "histoStretch:5,250|median:3|errDiffusion:1,1,2.2"
+// Missing trailing arguments take defaults; a window operator given one
+// size uses it for both dimensions (HW_batchUsage lists the operators).
+//
+// Files are processed by a work-stealing pool: each worker thread owns a
+// deque of loaded images, takes work from its own deque and steals from
+// the others when it runs dry. Each image is processed by one worker, so
+// a batch of small images parallelizes across files. Images of at least
+// largePixels pixels also parallelize within the file: their operators
+// may use the threads that have no file of their own to work on
+// (HW_threadBudget), which keeps the total near the thread count.
+//
+// A reader thread loads images ahead of the workers, and a writer thread
+// saves the results, so that file I/O overlaps compute. At most
+// 2 x threads images are loaded but not yet written.
+//
+//   HW_Batch batch;
+//   if (!batch.setChain("blur:5|sharpen:5,2", err)) ...
+//   std::vector<std::string> files;
+//   HW_batchCollect(args, files);
+//   batch.run(files, "out");
+//   batch.report(stderr);
+//
+
+// statistics of one operator of the chain, summed over all images
+struct HW_BatchStageStats {
+    std::string name;           // step as written in the spec, e.g. "median:3"
+    long long   images;
+    double      busyMs;         // total time in the operator, all threads
+    double      maxMs;          // slowest single image
+};
+
+class HW_Batch {
+public:
+    typedef std::function<void(ImagePtr, const double*, ImagePtr)> Op;
+
+    // threads = 0: HW_threadCount()
+    explicit HW_Batch(int threads = 0, long long largePixels = 1 << 22);
+
+    // parse spec into the operator chain; false with a message in error
+    bool setChain(const std::string& spec, std::string& error);
+
+    // process files, writing each result under its file name into outDir
+    // (files with the same name from different directories get "-2", "-3",
+    // ... before the extension, with a message); returns the number of
+    // images written
+    int run(const std::vector<std::string>& files, const std::string& outDir);
+
+    const std::vector<HW_BatchStageStats>& stats() const { return m_stats; }
+    double wallMs() const { return m_wallMs; }
+    void report(FILE* fp) const;
+
+private:
+    struct Step {
+        std::string name;
+        std::vector<double> args;
+        Op fn;
+    };
+
+    int m_threads;
+    long long m_largePixels;
+    std::vector<Step> m_chain;
+    std::vector<HW_BatchStageStats> m_stats;
+    double m_wallMs, m_readMs, m_writeMs;
+    long long m_images, m_failed, m_steals;
+};
+
+// expand paths into image files: files are kept, directories are listed
+// (one level, hidden entries skipped, names sorted); returns the number
+// of paths that could not be read
+int HW_batchCollect(const std::vector<std::string>& paths, std::vector<std::string>& files);
+
+// list the chain operators with their arguments and defaults
+void HW_batchUsage(FILE* fp);
+
+#endif
@@ -0,0 +1,474 @@
+#include "IP.h"
+#include "HW_golden.h"
+#include "HW_graph.h"
+#include "HW_histogram.h"
+#include "HW_interleaved.h"
+#include "HW_parallel.h"
+#include "HW_pyramid.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+using namespace IP;
+
+void histoMatchApprox(ImagePtr, ImagePtr, ImagePtr);
+void HW_blurIntegral(ImagePtr, int, int, ImagePtr);
+void HW_convolveFixed(ImagePtr, ImagePtr, ImagePtr);
+void HW_convolveSeparable(ImagePtr, ImagePtr, ImagePtr);
+void HW_errDiffusionWavefront(ImagePtr, int, bool, double, ImagePtr);
+void HW_adaptiveThreshold(ImagePtr, int, int, double, ImagePtr);
+int  HW_thresholdOtsu(ImagePtr, ImagePtr);
+void HW_thresholdMultiOtsu(ImagePtr, int, ImagePtr);
+void HW_histoStretchAuto(ImagePtr, double, double, ImagePtr);
+void HW_quantizeAdaptive(ImagePtr, int, ImagePtr);
+void HW_erode(ImagePtr, int, int, ImagePtr);
+void HW_dilate(ImagePtr, int, int, ImagePtr);
+void HW_open(ImagePtr, int, int, ImagePtr);
+void HW_close(ImagePtr, int, int, ImagePtr);
+void HW_tophat(ImagePtr, int, int, ImagePtr);
+void HW_resize(ImagePtr, int, int, int, ImagePtr);
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// synthetic corpus
+//
+
+// deterministic linear congruential generator (same sequence on every platform)
+static unsigned int nextRand(unsigned int& state) {
+    state = state * 1664525u + 1013904223u;
+    return state >> 24;
+}
+
+static ImagePtr makeInput(int id, const char*& name) {
+    ImagePtr I;
+    ChannelPtr<uchar> p;
+    int type;
+    unsigned int seed = 12345u + id;
+
+    switch (id) {
+    case 0: {   // horizontal and vertical ramp
+        name = "ramp";
+        const int w = 67, h = 43;
+        I = IP_allocImage(w, h, BW_IMAGE);
+        IP_getChannel(I, 0, p, type);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x) p[y * w + x] = (uchar)((x * 4 + y * 2) & 0xFF);
+        break;
+    }
+    case 1: {   // uniform noise
+        name = "noise";
+        const int w = 64, h = 48;
+        I = IP_allocImage(w, h, BW_IMAGE);
+        IP_getChannel(I, 0, p, type);
+        for (int i = 0; i < w * h; ++i) p[i] = (uchar)nextRand(seed);
+        break;
+    }
+    case 2: {   // low contrast checkerboard with noise (uneven histogram)
+        name = "checker";
+        const int w = 50, h = 37;
+        I = IP_allocImage(w, h, BW_IMAGE);
+        IP_getChannel(I, 0, p, type);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x) {
+                int base = (((x >> 3) + (y >> 3)) & 1) ? 150 : 90;
+                p[y * w + x] = (uchar)(base + (int)(nextRand(seed) & 15));
+            }
+        break;
+    }
+    case 3: {   // rgb noise with different bias per channel
+        name = "rgb";
+        const int w = 40, h = 30;
+        I = IP_allocImage(w, h, RGB_IMAGE);
+        for (int ch = 0; IP_getChannel(I, ch, p, type); ch++)
+            for (int i = 0; i < w * h; ++i) p[i] = (uchar)((nextRand(seed) >> 1) + ch * 60);
+        break;
+    }
+    default: {  // image smaller than most filter windows
+        name = "tiny";
+        const int w = 3, h = 2;
+        I = IP_allocImage(w, h, BW_IMAGE);
+        IP_getChannel(I, 0, p, type);
+        for (int i = 0; i < w * h; ++i) p[i] = (uchar)(i * 50);
+        break;
+    }
+    }
+    return I;
+}
+static const int NumInputs = 5;
+
+// target histograms for HW_histoMatch: 0 = flat, 1 = ramp
+static ImagePtr makeTargetHisto(int id) {
+    ImagePtr I = IP_allocImage(MXGRAY, 1, BW_IMAGE);
+    ChannelPtr<uchar> p;
+    int type;
+    IP_getChannel(I, 0, p, type);
+    for (int i = 0; i < MXGRAY; ++i) p[i] = (uchar)(id == 0 ? 1 : i);
+    return I;
+}
+
+// kernels for HW_convolve: 0 = 3x3 box, 1 = 3x3 sharpen, 2 = 5x5 binomial, 3 = 25x25 box
+static ImagePtr makeKernel(int id) {
+    const int sz = (id == 3) ? 25 : (id == 2) ? 5 : 3;
+    ImagePtr K = IP_allocImage(sz, sz, FLOATCH_TYPE);
+    ChannelPtr<float> p;
+    int type;
+    IP_getChannel(K, 0, p, type);
+
+    const float binomial[5] = { 1, 4, 6, 4, 1 };
+    for (int y = 0; y < sz; ++y)
+        for (int x = 0; x < sz; ++x) {
+            float v;
+            if (id == 0) v = 1.0f / 9.0f;
+            else if (id == 1) v = (x == 1 && y == 1) ? 5.0f : ((x == 1 || y == 1) ? -1.0f : 0.0f);
+            else if (id == 2) v = binomial[x] * binomial[y] / 256.0f;
+            else v = 1.0f / 625.0f;
+            p[y * sz + x] = v;
+        }
+    return K;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// operators and parameter sets
+//
+
+struct GoldenOp {
+    const char* name;
+    std::vector<std::vector<double>> params;
+    HW_GoldenFn ref;
+};
+
+struct GoldenVariant {
+    std::string op;
+    std::string name;
+    int tolerance;
+    HW_GoldenFn fn;
+};
+
+// optimized paths shipped in this tree, checked against their reference operator
+// run an interleaved-layout operator on planar I: pack, process, unpack into O
+static void viaInterleaved(ImagePtr I, ImagePtr O,
+                           const std::function<void(const HW_Interleaved&, const HW_Interleaved&)>& fn) {
+    const int w = I->width(), h = I->height(), C = I->maxDepth();
+    std::vector<uchar> src((size_t)w * h * C), dst(src.size());
+    HW_Interleaved s = HW_interleaved(&src[0], w, h, C);
+    HW_Interleaved d = HW_interleaved(&dst[0], w, h, C);
+    HW_interleave(I, s);
+    fn(s, d);
+
+    ImagePtr J = HW_deinterleave(d);
+    IP_copyImageHeader(J, O);
+    ChannelPtr<uchar> pj, po;
+    int type;
+    for (int ch = 0; IP_getChannel(J, ch, pj, type); ch++) {
+        IP_getChannel(O, ch, po, type);
+        std::memcpy((uchar*)po, (uchar*)pj, (size_t)w * h);
+    }
+}
+
+static std::vector<GoldenVariant> builtinVariants() {
+    std::vector<GoldenVariant> v = {
+        { "blur", "integral", 1,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_blurIntegral(I, (int)a[0], (int)a[1], O); } },
+        { "blur", "interleaved", 0,
+          [](ImagePtr I, const double* a, ImagePtr O) {
+              viaInterleaved(I, O, [&](const HW_Interleaved& s, const HW_Interleaved& d) {
+                  HW_interleavedBlur(s, (int)a[0], (int)a[1], d);
+              });
+          } },
+        { "blur", "fused", 0,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_Graph().setTileRows(16).blur((int)a[0], (int)a[1]).run(I, O); } },
+        { "convolve", "fixed", 1,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_convolveFixed(I, makeKernel((int)a[0]), O); } },
+        { "convolve", "separable", 1,
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_convolveSeparable(I, makeKernel((int)a[0]), O); } },
+        { "errDiffusion", "wavefront", 0,
+          [](ImagePtr I, const double* a, ImagePtr O) {
+              // several threads even on one core, so the row hand-off is exercised
+              const int saved = HW_threadSetting();
+              HW_setThreadCount(4);
+              HW_errDiffusionWavefront(I, (int)a[0], a[1] != 0, a[2], O);
+              HW_setThreadCount(saved);
+          } },
+        { "median", "interleaved", 0,
+          [](ImagePtr I, const double* a, ImagePtr O) {
+              viaInterleaved(I, O, [&](const HW_Interleaved& s, const HW_Interleaved& d) {
+                  HW_interleavedMedian(s, (int)a[0], d);
+              });
+          } },
+        { "clip", "interleaved", 0,
+          [](ImagePtr I, const double* a, ImagePtr O) {
+              uchar lut[MXGRAY];
+              HW_pointOpLut([&](ImagePtr J1, ImagePtr J2) { HW_clip(J1, (int)a[0], (int)a[1], J2); }, lut);
+              const uchar* luts[4] = { lut, lut, lut, lut };
+              viaInterleaved(I, O, [&](const HW_Interleaved& s, const HW_Interleaved& d) {
+                  HW_interleavedLut(s, luts, d);
+              });
+          } },
+        { "histoMatch", "interleaved", 0,
+          [](ImagePtr I, const double* a, ImagePtr O) {
+              // only the approximate (CDF) algorithm is a per-channel LUT
+              if (a[1] == 0) {
+                  HW_histoMatch(I, makeTargetHisto((int)a[0]), false, O);
+                  return;
+              }
+              ImagePtr target = makeTargetHisto((int)a[0]);
+              viaInterleaved(I, O, [&](const HW_Interleaved& s, const HW_Interleaved& d) {
+                  HW_interleavedHistoMatch(s, target, d);
+              });
+          } },
+    };
+    return v;
+}
+
+static std::vector<GoldenVariant>& variants() {
+    static std::vector<GoldenVariant> v = builtinVariants();
+    return v;
+}
+
+static std::vector<GoldenOp> makeOps() {
+    std::vector<GoldenOp> ops = {
+        { "threshold", { { 0 }, { 128 }, { 255 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_threshold(I, (int)a[0], O); } },
+        { "adaptiveThreshold", { { 0, 15, 0.15 }, { 1, 15, -0.2 }, { 2, 31, 0.34 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_adaptiveThreshold(I, (int)a[0], (int)a[1], a[2], O); } },
+        { "thresholdOtsu", { { 0 } },
+          [](ImagePtr I, const double*, ImagePtr O) { HW_thresholdOtsu(I, O); } },
+        { "thresholdMultiOtsu", { { 3 }, { 4 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_thresholdMultiOtsu(I, (int)a[0], O); } },
+        { "clip", { { 50, 200 }, { 200, 50 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_clip(I, (int)a[0], (int)a[1], O); } },
+        { "quantize", { { 4, 0 }, { 16, 0 }, { 4, 1 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_quantize(I, (int)a[0], a[1] != 0, O); } },
+        { "quantizeAdaptive", { { 2 }, { 4 }, { 16 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_quantizeAdaptive(I, (int)a[0], O); } },
+        { "gamma", { { 0.5 }, { 2.2 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_gammaCorrect(I, a[0], O); } },
+        { "contrast", { { 10, 1.5 }, { -20, 0.5 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_contrast(I, a[0], a[1], O); } },
+        { "histoStretch", { { 5, 250 }, { 90, 170 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_histoStretch(I, (int)a[0], (int)a[1], O); } },
+        { "histoStretchAuto", { { 1, 99 }, { 5, 95 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_histoStretchAuto(I, a[0], a[1], O); } },
+        { "histoMatch", { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_histoMatch(I, makeTargetHisto((int)a[0]), a[1] != 0, O); } },
+        { "histoMatchSampled", { { 500, 1, 0 }, { 500, 1, 1 }, { 0, 4, 0 } },
+          [](ImagePtr I, const double* a, ImagePtr O) {
+              // approximate matching from a sampled histogram: budget a[0], row stride a[1], target a[2]
+              HW_setHistogramSampling((long long)a[0], (int)a[1]);
+              HW_histoMatch(I, makeTargetHisto((int)a[2]), true, O);
+              HW_setHistogramSampling(0, 1);
+          } },
+        { "errDiffusion", { { 0, 0, 1.0 }, { 0, 1, 1.0 }, { 1, 1, 2.2 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_errDiffusion(I, (int)a[0], a[1] != 0, a[2], O); } },
+        { "blur", { { 3, 3 }, { 9, 5 }, { 1, 15 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_blur(I, (int)a[0], (int)a[1], O); } },
+        { "sharpen", { { 3, 1.0 }, { 5, 2.5 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_sharpen(I, (int)a[0], a[1], O); } },
+        { "median", { { 3 }, { 5 }, { 9 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_median(I, (int)a[0], O); } },
+        { "convolve", { { 0 }, { 1 }, { 2 }, { 3 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_convolve(I, makeKernel((int)a[0]), O); } },
+        { "pyramid", { { 1 }, { 2 } },
+          [](ImagePtr I, const double* a, ImagePtr O) {
+              HW_Pyramid pyr;
+              pyr.build(I, (int)a[0] + 1, true);
+              // copy the coarsest level out (clip to [0,255] is the identity)
+              pyr.run([](ImagePtr L, int, ImagePtr R) { HW_clip(L, 0, MaxGray, R); }, pyr.levels() - 1, O);
+          } },
+        { "pyramidExpand", { { 1 } },
+          [](ImagePtr I, const double*, ImagePtr O) {
+              HW_Pyramid pyr;
+              pyr.build(I, 2);
+              pyr.reconstruct(O);
+          } },
+        { "resize", { { 0.5, 0 }, { 0.3, 0 }, { 0.5, 1 }, { 1.7, 1 }, { 0.6, 2 }, { 1.5, 2 } },
+          [](ImagePtr I, const double* a, ImagePtr O) {
+              // scale factor a[0], method a[1]
+              HW_resize(I, std::max(1, (int)(I->width() * a[0])), std::max(1, (int)(I->height() * a[0])), (int)a[1], O);
+          } },
+        { "erode", { { 3, 3 }, { 7, 1 }, { 5, 9 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_erode(I, (int)a[0], (int)a[1], O); } },
+        { "dilate", { { 3, 3 }, { 7, 1 }, { 5, 9 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_dilate(I, (int)a[0], (int)a[1], O); } },
+        { "open", { { 3, 3 }, { 9, 9 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_open(I, (int)a[0], (int)a[1], O); } },
+        { "close", { { 3, 3 }, { 9, 9 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_close(I, (int)a[0], (int)a[1], O); } },
+        { "tophat", { { 9, 9 }, { 15, 3 } },
+          [](ImagePtr I, const double* a, ImagePtr O) { HW_tophat(I, (int)a[0], (int)a[1], O); } },
+    };
+    return ops;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// checksums and raw output files
+//
+
+unsigned long long HW_imageChecksum(ImagePtr I) {
+    unsigned long long hash = 14695981039346656037ULL;
+    auto mix = [&](unsigned int v) { hash ^= v; hash *= 1099511628211ULL; };
+
+    const int total = I->width() * I->height();
+    mix(I->width());
+    mix(I->height());
+
+    ChannelPtr<uchar> p;
+    int type;
+    for (int ch = 0; IP_getChannel(I, ch, p, type); ch++)
+        for (int i = 0; i < total; ++i) mix(p[i]);
+    return hash;
+}
+
+static std::string casePath(const char* dir, const std::string& id) {
+    return std::string(dir) + "/" + id + ".raw";
+}
+
+static bool writeRaw(const std::string& path, ImagePtr I) {
+    FILE* fp = std::fopen(path.c_str(), "wb");
+    if (!fp) return false;
+
+    const int total = I->width() * I->height();
+    ChannelPtr<uchar> p;
+    int type;
+    for (int ch = 0; IP_getChannel(I, ch, p, type); ch++)
+        std::fwrite(&p[0], 1, total, fp);
+    std::fclose(fp);
+    return true;
+}
+
+// largest absolute pixel difference between I and the stored raw output (-1 if unreadable)
+static int compareRaw(const std::string& path, ImagePtr I) {
+    FILE* fp = std::fopen(path.c_str(), "rb");
+    if (!fp) return -1;
+
+    const int total = I->width() * I->height();
+    std::vector<uchar> ref(total);
+    ChannelPtr<uchar> p;
+    int type, maxDiff = 0;
+    for (int ch = 0; IP_getChannel(I, ch, p, type); ch++) {
+        if ((int)std::fread(ref.data(), 1, total, fp) != total) { maxDiff = -1; break; }
+        for (int i = 0; i < total; ++i) {
+            int d = (int)p[i] - (int)ref[i];
+            if (d < 0) d = -d;
+            if (d > maxDiff) maxDiff = d;
+        }
+    }
+    std::fclose(fp);
+    return maxDiff;
+}
+
+// run fn on a fresh output image; quantize dither uses rand(), so reseed every run
+static ImagePtr runCase(const HW_GoldenFn& fn, ImagePtr I, const double* a) {
+    ImagePtr O;
+    std::srand(1);
+    fn(I, a, O);
+    return O;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_goldenAddVariant:
+//
+// Register an optimized implementation of operator op (e.g. "blur").
+// It is checked against op's golden outputs by HW_goldenVerify().
+//
+void HW_goldenAddVariant(const char* op, const char* variant, int tolerance, HW_GoldenFn fn) {
+    variants().push_back({ op, variant, tolerance, fn });
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_goldenRecord:
+//
+// Run the reference operators over the corpus and store their outputs in dir.
+// The manifest dir/golden.txt lists "<case> <width> <height> <checksum>".
+//
+int HW_goldenRecord(const char* dir) {
+    std::string manifest = std::string(dir) + "/golden.txt";
+    FILE* fp = std::fopen(manifest.c_str(), "w");
+    if (!fp) {
+        std::fprintf(stderr, "golden: cannot write %s\n", manifest.c_str());
+        return 1;
+    }
+
+    int failures = 0;
+    std::vector<GoldenOp> ops = makeOps();
+    for (int in = 0; in < NumInputs; ++in) {
+        const char* inName;
+        ImagePtr I = makeInput(in, inName);
+
+        for (const GoldenOp& op : ops) {
+            for (size_t k = 0; k < op.params.size(); ++k) {
+                std::string id = std::string(op.name) + "-" + std::to_string(k) + "-" + inName;
+                ImagePtr O = runCase(op.ref, I, op.params[k].data());
+
+                if (!writeRaw(casePath(dir, id), O)) ++failures;
+                std::fprintf(fp, "%s %d %d %016llx\n", id.c_str(), O->width(), O->height(), HW_imageChecksum(O));
+            }
+        }
+    }
+    std::fclose(fp);
+    return failures;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_goldenVerify:
+//
+// Compare the reference operators (always exact) and all registered
+// variants (within their tolerance) against the outputs stored in dir.
+//
+int HW_goldenVerify(const char* dir) {
+    std::string manifest = std::string(dir) + "/golden.txt";
+    FILE* fp = std::fopen(manifest.c_str(), "r");
+    if (!fp) {
+        std::fprintf(stderr, "golden: cannot read %s\n", manifest.c_str());
+        return 1;
+    }
+
+    // load expected checksums
+    std::map<std::string, unsigned long long> expected;
+    char id[256];
+    int w, h;
+    unsigned long long sum;
+    while (std::fscanf(fp, "%255s %d %d %llx", id, &w, &h, &sum) == 4) expected[id] = sum;
+    std::fclose(fp);
+
+    // check one output against the stored case; tolerance 0 means bit-exact
+    auto check = [&](const std::string& id, const std::string& who, int tolerance, ImagePtr O) {
+        auto it = expected.find(id);
+        if (it == expected.end()) {
+            std::fprintf(stderr, "golden: %s: no stored output (rerun HW_goldenRecord)\n", id.c_str());
+            return false;
+        }
+        if (HW_imageChecksum(O) == it->second) return true;
+        if (tolerance > 0) {
+            int diff = compareRaw(casePath(dir, id), O);
+            if (diff >= 0 && diff <= tolerance) return true;
+            std::fprintf(stderr, "golden: %s [%s]: max difference %d exceeds %d\n", id.c_str(), who.c_str(), diff, tolerance);
+            return false;
+        }
+        std::fprintf(stderr, "golden: %s [%s]: checksum mismatch\n", id.c_str(), who.c_str());
+        return false;
+    };
+
+    int failures = 0;
+    std::vector<GoldenOp> ops = makeOps();
+    for (int in = 0; in < NumInputs; ++in) {
+        const char* inName;
+        ImagePtr I = makeInput(in, inName);
+
+        for (const GoldenOp& op : ops) {
+            for (size_t k = 0; k < op.params.size(); ++k) {
+                std::string caseId = std::string(op.name) + "-" + std::to_string(k) + "-" + inName;
+                const double* a = op.params[k].data();
+
+                if (!check(caseId, "reference", 0, runCase(op.ref, I, a))) ++failures;
+                for (const GoldenVariant& v : variants()) {
+                    if (v.op != op.name) continue;
+                    if (!check(caseId, v.name, v.tolerance, runCase(v.fn, I, a))) ++failures;
+                }
+            }
+        }
+    }
+    return failures;
+}
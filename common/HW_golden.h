@@ -0,0 +1,38 @@
+#ifndef HW_GOLDEN_H
+#define HW_GOLDEN_H
+
+#include "IP.h"
+#include <functional>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Golden-output regression harness.
+//
+// A fixed corpus of synthetic inputs is pushed through every HW_* operator
+// with a fixed list of parameter sets. HW_goldenRecord() stores a checksum
+// and the raw output bytes of each case in directory dir, computed with the
+// current scalar implementations. HW_goldenVerify() reruns the reference
+// operators plus every registered variant (SIMD, threaded, fused paths) and
+// compares them against the stored outputs.
+//
+// Variants are registered per operator with a tolerance:
+//   tolerance = 0: output must be bit-exact (checksum match)
+//   tolerance = n: every output pixel may differ by at most n
+//
+// Both functions return the number of failed cases (0 on success).
+//
+// The outputs of the baseline scalar operators are committed in golden/
+// (operators added later with their first implementation), and
+// tools/hwgolden.cpp verifies against them or records them again.
+//
+
+// a variant receives the input image, the case parameters and the output image
+typedef std::function<void(ImagePtr, const double*, ImagePtr)> HW_GoldenFn;
+
+void HW_goldenAddVariant(const char* op, const char* variant, int tolerance, HW_GoldenFn fn);
+int  HW_goldenRecord(const char* dir);
+int  HW_goldenVerify(const char* dir);
+
+// 64-bit FNV-1a checksum over image dimensions and all channel bytes
+unsigned long long HW_imageChecksum(ImagePtr I);
+
+#endif
@@ -0,0 +1,336 @@
+#include "IP.h"
+#include "HW_graph.h"
+#include "HW_instrument.h"
+#include "HW_interleaved.h"
+#include "HW_parallel.h"
+#include "HW_pixel.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+using namespace IP;
+
+static inline int clampIndex(int v, int n) {
+    return (v < 0) ? 0 : (v >= n ? n - 1 : v);
+}
+
+static void copyImage(ImagePtr I1, ImagePtr I2) {
+    IP_copyImageHeader(I1, I2);
+    const int type = HW_pixelType(I1);
+    const size_t bytes = (size_t)I1->width() * I1->height() *
+                         (type == SHORT_TYPE ? sizeof(unsigned short) : type == FLOAT_TYPE ? sizeof(float) : 1);
+    ChannelPtr<uchar> p1, p2;
+    int t;
+    for (int ch = 0; IP_getChannel(I1, ch, p1, t); ch++) {
+        IP_getChannel(I2, ch, p2, t);
+        std::memcpy((uchar*)p2, (uchar*)p1, bytes);
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// fused kernels
+//
+
+static void lutPass(ImagePtr I1, const uchar lut[MXGRAY], ImagePtr I2) {
+    IP_copyImageHeader(I1, I2);
+    const int total = I1->width() * I1->height();
+    ChannelPtr<uchar> p1, p2;
+    int type;
+    for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
+        IP_getChannel(I2, ch, p2, type);
+        const uchar* in = p1;
+        uchar* out = p2;
+        HW_parallelFor(0, total, 1 << 16, [&](int lo, int hi) {
+            for (int i = lo; i < hi; ++i) out[i] = lut[in[i]];
+        });
+    }
+}
+
+// HW_blur on one channel with pre applied to every loaded pixel and post to
+// every stored one. Each tile of tileRows rows streams its input rows through
+// a ring of filterH horizontally averaged rows; both averages truncate, as
+// in HW_blur's two passes.
+static void fusedBlur(const uchar* src, int w, int h, const uchar* pre, int filterW, int filterH,
+                      const uchar* post, int tileRows, uchar* dst) {
+    const int halfWidth = filterW / 2;
+    const int halfHeight = filterH / 2;
+    const int tiles = (h + tileRows - 1) / tileRows;
+
+    HW_parallelFor(0, tiles, 1, [&](int t0, int t1) {
+        std::vector<uchar> line(w + 2 * halfWidth + 1), ring((size_t)filterH * w);
+        std::vector<int> colSum(w);
+        HW_PROFILE_ALLOC(line.size() + ring.size() + w * sizeof(int));
+
+        // load row clamp(s) through pre, average horizontally into its ring slot
+        auto averageRow = [&](int s) {
+            const uchar* r = src + (long long)clampIndex(s, h) * w;
+            uchar* L = &line[halfWidth];
+            for (int x = 0; x < w; ++x) L[x] = pre[r[x]];
+            for (int k = 1; k <= halfWidth + 1; ++k) {
+                if (k <= halfWidth) L[-k] = L[0];
+                L[w - 1 + k] = L[w - 1];
+            }
+
+            uchar* out = &ring[(size_t)((s + halfHeight) % filterH) * w];
+            int sum = 0;
+            for (int dx = -halfWidth; dx <= halfWidth; ++dx) sum += L[dx];
+            for (int x = 0; x < w; ++x) {
+                out[x] = (uchar)(sum / filterW);
+                sum += L[x + halfWidth + 1] - L[x - halfWidth];
+            }
+            return out;
+        };
+
+        for (int t = t0; t < t1; ++t) {
+            const int y0 = t * tileRows;
+            const int y1 = (y0 + tileRows < h) ? y0 + tileRows : h;
+
+            std::fill(colSum.begin(), colSum.end(), 0);
+            for (int s = y0 - halfHeight; s <= y0 + halfHeight; ++s) {
+                const uchar* row = averageRow(s);
+                for (int x = 0; x < w; ++x) colSum[x] += row[x];
+            }
+
+            for (int y = y0; y < y1; ++y) {
+                uchar* d = dst + (long long)y * w;
+                for (int x = 0; x < w; ++x) d[x] = post[colSum[x] / filterH];
+
+                // slide window one row down
+                if (y + 1 < y1) {
+                    const int s = y + halfHeight + 1;
+                    const uchar* old = &ring[(size_t)((s + halfHeight) % filterH) * w];
+                    for (int x = 0; x < w; ++x) colSum[x] -= old[x];
+                    const uchar* row = averageRow(s);
+                    for (int x = 0; x < w; ++x) colSum[x] += row[x];
+                }
+            }
+        }
+    });
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// graph building
+//
+
+HW_Graph::HW_Graph() : m_tileRows(64) {}
+
+HW_Graph& HW_Graph::point(const char* name, Op op) {
+    Node n;
+    n.kind = POINT;
+    n.name = name;
+    n.op = op;
+    n.filterW = n.filterH = 0;
+    HW_pointOpLut(op, n.lut);
+    m_nodes.push_back(n);
+    return *this;
+}
+
+HW_Graph& HW_Graph::threshold(int thr) {
+    return point("threshold", [=](ImagePtr I1, ImagePtr I2) { HW_threshold(I1, thr, I2); });
+}
+
+HW_Graph& HW_Graph::clip(int t1, int t2) {
+    return point("clip", [=](ImagePtr I1, ImagePtr I2) { HW_clip(I1, t1, t2, I2); });
+}
+
+HW_Graph& HW_Graph::quantize(int levels) {
+    return point("quantize", [=](ImagePtr I1, ImagePtr I2) { HW_quantize(I1, levels, false, I2); });
+}
+
+HW_Graph& HW_Graph::gammaCorrect(double gamma) {
+    return point("gamma", [=](ImagePtr I1, ImagePtr I2) { HW_gammaCorrect(I1, gamma, I2); });
+}
+
+HW_Graph& HW_Graph::contrast(double brightness, double contrast) {
+    return point("contrast", [=](ImagePtr I1, ImagePtr I2) { HW_contrast(I1, brightness, contrast, I2); });
+}
+
+HW_Graph& HW_Graph::histoStretch(int t1, int t2) {
+    return point("histoStretch", [=](ImagePtr I1, ImagePtr I2) { HW_histoStretch(I1, t1, t2, I2); });
+}
+
+HW_Graph& HW_Graph::blur(int filterW, int filterH) {
+    // make sure filter dimensions are odd and positive
+    if (filterW < 1) filterW = 1;
+    if (filterH < 1) filterH = 1;
+    if ((filterW & 1) == 0) filterW++;
+    if ((filterH & 1) == 0) filterH++;
+
+    Node n;
+    n.kind = BLUR;
+    n.name = "blur";
+    n.op = [=](ImagePtr I1, ImagePtr I2) { HW_blur(I1, filterW, filterH, I2); };
+    n.filterW = filterW;
+    n.filterH = filterH;
+    m_nodes.push_back(n);
+    return *this;
+}
+
+HW_Graph& HW_Graph::op(const char* name, Op op) {
+    Node n;
+    n.kind = OPAQUE;
+    n.name = name;
+    n.op = op;
+    n.filterW = n.filterH = 0;
+    m_nodes.push_back(n);
+    return *this;
+}
+
+HW_Graph& HW_Graph::setTileRows(int rows) {
+    m_tileRows = (rows < 1) ? 1 : rows;
+    return *this;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// planner
+//
+
+static void identityLut(uchar lut[MXGRAY]) {
+    for (int i = 0; i < MXGRAY; ++i) lut[i] = (uchar)i;
+}
+
+// lut = next(lut)
+static void composeLut(uchar lut[MXGRAY], const uchar next[MXGRAY]) {
+    for (int i = 0; i < MXGRAY; ++i) lut[i] = next[lut[i]];
+}
+
+static void appendName(std::string& names, const std::string& name) {
+    if (!names.empty()) names += ", ";
+    names += name;
+}
+
+void HW_Graph::segments(std::vector<Segment>& segs) const {
+    segs.clear();
+
+    Segment cur;
+    auto reset = [&](Kind kind) {
+        cur.kind = kind;
+        identityLut(cur.pre);
+        identityLut(cur.post);
+        cur.hasPre = cur.hasPost = false;
+        cur.preNames.clear();
+        cur.postNames.clear();
+        cur.filterW = cur.filterH = 0;
+        cur.node = 0;
+    };
+    // cur is an open LUT segment (point ops collect in pre) or an open blur (point ops collect in post)
+    bool open = false;
+    auto close = [&]() {
+        if (open && (cur.kind == BLUR || cur.hasPre)) segs.push_back(cur);
+        open = false;
+    };
+
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        const Node& n = m_nodes[i];
+        if (n.kind == POINT) {
+            if (!open) {
+                reset(POINT);
+                open = true;
+            }
+            bool toPost = (cur.kind == BLUR);
+            composeLut(toPost ? cur.post : cur.pre, n.lut);
+            appendName(toPost ? cur.postNames : cur.preNames, n.name);
+            (toPost ? cur.hasPost : cur.hasPre) = true;
+        }
+        else if (n.kind == BLUR) {
+            // pending point ops become the blur's load LUT
+            if (open && cur.kind == BLUR) close();
+            if (!open) reset(POINT);
+            cur.kind = BLUR;
+            cur.filterW = n.filterW;
+            cur.filterH = n.filterH;
+            cur.node = &n;
+            open = true;
+        }
+        else {
+            close();
+            reset(OPAQUE);
+            cur.node = &n;
+            segs.push_back(cur);
+        }
+    }
+    close();
+
+    // an empty chain still copies I1 to I2
+    if (segs.empty()) {
+        reset(POINT);
+        segs.push_back(cur);
+    }
+}
+
+std::string HW_Graph::plan() const {
+    std::vector<Segment> segs;
+    segments(segs);
+
+    std::string s;
+    char buf[64];
+    for (size_t i = 0; i < segs.size(); ++i) {
+        const Segment& seg = segs[i];
+        if (seg.kind == POINT) {
+            s += "lut [" + (seg.hasPre ? seg.preNames : std::string("copy")) + "]";
+        }
+        else if (seg.kind == BLUR) {
+            std::snprintf(buf, sizeof(buf), "blur %dx%d", seg.filterW, seg.filterH);
+            s += buf;
+            if (seg.hasPre) s += " [load: " + seg.preNames + "]";
+            if (seg.hasPost) s += " [store: " + seg.postNames + "]";
+        }
+        else {
+            s += seg.node->name;
+        }
+        s += "\n";
+    }
+    return s;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// execution
+//
+
+void HW_Graph::run(ImagePtr I1, ImagePtr I2) const {
+    const long long pixels = (long long)I1->width() * I1->height() * I1->maxDepth();
+    HW_PROFILE("HW_graph", pixels, 2 * pixels);
+
+    // 16-bit and float: one node at a time
+    if (HW_pixelType(I1) != UCHAR_TYPE) {
+        if (m_nodes.empty()) {
+            copyImage(I1, I2);
+            return;
+        }
+        ImagePtr cur = I1;
+        for (size_t i = 0; i < m_nodes.size(); ++i) {
+            ImagePtr out;
+            if (i + 1 == m_nodes.size()) out = I2;
+            m_nodes[i].op(cur, out);
+            cur = out;
+        }
+        return;
+    }
+
+    std::vector<Segment> segs;
+    segments(segs);
+
+    ImagePtr cur = I1;
+    for (size_t i = 0; i < segs.size(); ++i) {
+        const Segment& seg = segs[i];
+        ImagePtr out;
+        if (i + 1 == segs.size()) out = I2;
+
+        if (seg.kind == POINT) {
+            lutPass(cur, seg.pre, out);
+        }
+        else if (seg.kind == BLUR) {
+            IP_copyImageHeader(cur, out);
+            const int w = cur->width(), h = cur->height();
+            ChannelPtr<uchar> p1, p2;
+            int type;
+            for (int ch = 0; IP_getChannel(cur, ch, p1, type); ch++) {
+                IP_getChannel(out, ch, p2, type);
+                fusedBlur(p1, w, h, seg.pre, seg.filterW, seg.filterH, seg.post, m_tileRows, p2);
+            }
+        }
+        else {
+            seg.node->op(cur, out);
+        }
+        cur = out;
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef HW_GRAPH_H
+#define HW_GRAPH_H
+
+#include "IP.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_Graph:
+//
+// Deferred evaluation of a chain of HW_* operators. Nodes are only
+// recorded when the chain is built; run() plans and executes the whole
+// chain, so
+//   HW_Graph().gammaCorrect(2.2).blur(5, 5).threshold(128).run(I1, I2);
+// reads I1 once and writes I2 once, without the two intermediate images
+// of calling HW_gammaCorrect, HW_blur and HW_threshold in turn.
+//
+// The planner works on 8-bit images:
+// - consecutive point operators are composed into one 256-entry LUT
+//   (the LUT of a point operator is its output on a ramp, HW_pointOpLut);
+// - the LUT in front of a blur is applied while loading rows into the
+//   horizontal pass, and the LUT after it in the vertical-pass store;
+// - a fused blur runs in tiles of tileRows rows: each tile keeps its
+//   horizontally averaged rows in a small ring and never writes an
+//   intermediate image. Tiles run in parallel.
+// Results are identical to running the operators one by one. Other
+// operators (op()) are opaque: the chain is materialized around them.
+// 16-bit and float images run the nodes one by one.
+//
+
+class HW_Graph {
+public:
+    typedef std::function<void(ImagePtr, ImagePtr)> Op;
+
+    HW_Graph();
+
+    // point operators
+    HW_Graph& point(const char* name, Op op);       // any HW_* point operator
+    HW_Graph& threshold(int thr);
+    HW_Graph& clip(int t1, int t2);
+    HW_Graph& quantize(int levels);
+    HW_Graph& gammaCorrect(double gamma);
+    HW_Graph& contrast(double brightness, double contrast);
+    HW_Graph& histoStretch(int t1, int t2);
+
+    // stencil and opaque operators
+    HW_Graph& blur(int filterW, int filterH);
+    HW_Graph& op(const char* name, Op op);
+
+    HW_Graph& setTileRows(int rows);
+
+    // execute the chain on I1; output is in I2
+    void run(ImagePtr I1, ImagePtr I2) const;
+
+    // planned segments, one per line, e.g. "blur 5x5 [load: gamma] [store: threshold]"
+    std::string plan() const;
+
+private:
+    enum Kind { POINT, BLUR, OPAQUE };
+
+    struct Node {
+        Kind kind;
+        std::string name;
+        Op op;
+        IP::uchar lut[IP::MXGRAY];      // POINT
+        int filterW, filterH;           // BLUR
+    };
+
+    // one executed step: a LUT pass, a fused blur or an opaque operator
+    struct Segment {
+        Kind kind;
+        IP::uchar pre[IP::MXGRAY], post[IP::MXGRAY];
+        bool hasPre, hasPost;
+        std::string preNames, postNames;
+        int filterW, filterH;
+        const Node* node;
+    };
+
+    void segments(std::vector<Segment>& segs) const;
+
+    std::vector<Node> m_nodes;
+    int m_tileRows;
+};
+
+#endif
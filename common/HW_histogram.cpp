@@ -0,0 +1,320 @@
+#include "IP.h"
+#include "HW_histogram.h"
+#include "HW_parallel.h"
+#include "HW_pixel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+using namespace IP;
+
+// count p[0..n) into 4 interleaved sub-histograms and add them to H
+static void countBand(const uchar* p, int n, int H[MXGRAY]) {
+    int sub[4][MXGRAY];
+    std::memset(sub, 0, sizeof(sub));
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        ++sub[0][p[i]];
+        ++sub[1][p[i + 1]];
+        ++sub[2][p[i + 2]];
+        ++sub[3][p[i + 3]];
+    }
+    for (; i < n; ++i) ++sub[0][p[i]];
+
+    for (int v = 0; v < MXGRAY; ++v) H[v] += sub[0][v] + sub[1][v] + sub[2][v] + sub[3][v];
+}
+
+void HW_histogram(const uchar* p, int n, int H[MXGRAY]) {
+    std::memset(H, 0, MXGRAY * sizeof(int));
+
+    std::mutex merge;
+    HW_parallelFor(0, n, 1 << 18, [&](int lo, int hi) {
+        int local[MXGRAY] = { 0 };
+        countBand(p + lo, hi - lo, local);
+
+        std::lock_guard<std::mutex> lock(merge);
+        for (int v = 0; v < MXGRAY; ++v) H[v] += local[v];
+    });
+}
+
+// 256-bin histogram of a (possibly sampled) channel; returns the number of samples
+template <class T>
+static long long binnedHistogram(const T* p, int w, int h, long long H[MXGRAY]) {
+    const double inv = 1.0 / HW_pixelScale<T>();
+    return HW_samplePixels(p, w, h, [&](T v) { ++H[HW_histogramBin(v * inv)]; });
+}
+
+static bool samplingEnabled(long long total) {
+    const HW_HistogramSampling& s = HW_histogramSampling();
+    return s.rowStride > 1 || (s.budget > 0 && s.budget < total);
+}
+
+// add the (possibly sampled) histogram of channel ch of I to H; returns the number of samples
+static long long addChannelHistogram(ImagePtr I, int ch, long long H[MXGRAY]) {
+    const int w = I->width(), h = I->height();
+    const int total = w * h;
+    int type;
+    switch (HW_pixelType(I)) {
+    case SHORT_TYPE: {
+        ChannelPtr<unsigned short> p;
+        IP_getChannel(I, ch, p, type);
+        return binnedHistogram<unsigned short>(p, w, h, H);
+    }
+    case FLOAT_TYPE: {
+        ChannelPtr<float> p;
+        IP_getChannel(I, ch, p, type);
+        return binnedHistogram<float>(p, w, h, H);
+    }
+    default: {
+        ChannelPtr<uchar> p;
+        IP_getChannel(I, ch, p, type);
+        if (samplingEnabled(total))
+            return HW_samplePixels((const uchar*)p, w, h, [&](uchar v) { ++H[v]; });
+        int Hch[MXGRAY];
+        HW_histogram(p, total, Hch);
+        for (int v = 0; v < MXGRAY; ++v) H[v] += Hch[v];
+        return total;
+    }
+    }
+}
+
+HW_HistogramSamples HW_imageHistogram(ImagePtr I, long long H[MXGRAY]) {
+    for (int v = 0; v < MXGRAY; ++v) H[v] = 0;
+
+    HW_HistogramSamples s = { 0, (long long)I->width() * I->height() * I->maxDepth() };
+    for (int ch = 0; ch < I->maxDepth(); ch++) s.samples += addChannelHistogram(I, ch, H);
+    HW_histogramNoteSamples(s.samples, s.population);
+    return s;
+}
+
+HW_HistogramSamples HW_channelHistogram(ImagePtr I, int ch, long long H[MXGRAY]) {
+    for (int v = 0; v < MXGRAY; ++v) H[v] = 0;
+
+    HW_HistogramSamples s = { addChannelHistogram(I, ch, H), (long long)I->width() * I->height() };
+    HW_histogramNoteSamples(s.samples, s.population);
+    return s;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// sampling error
+//
+
+// samples of the last histogram built on this thread
+static thread_local HW_HistogramSamples lastSamples = { 0, 0 };
+
+void HW_histogramNoteSamples(long long samples, long long population) {
+    lastSamples.samples = samples;
+    lastSamples.population = population;
+}
+
+double HW_cdfErrorBound(long long n, double confidence) {
+    if (n <= 0) return 1.0;
+    if (confidence <= 0.0 || confidence >= 1.0) confidence = 0.99;
+    return std::sqrt(std::log(2.0 / (1.0 - confidence)) / (2.0 * n));
+}
+
+double HW_histogramCdfError(const HW_HistogramSamples& s, double confidence) {
+    return (s.samples >= s.population) ? 0.0 : HW_cdfErrorBound(s.samples, confidence);
+}
+
+double HW_histogramCdfError(double confidence) {
+    return HW_histogramCdfError(lastSamples, confidence);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_multiOtsuThresholds:
+//
+// Maximizing the between-class variance is the same as maximizing
+// sum over classes of S^2/P, where P is the pixel count and S the sum of
+// values of a class. With prefix sums the score of a class is O(1), and
+// dynamic programming over the 256 bins finds the best split in
+// O(levels * 256^2), independent of image size.
+//
+int HW_multiOtsuThresholds(const long long H[MXGRAY], int levels, int thr[]) {
+    if (levels < 2) levels = 2;
+    if (levels > 8) levels = 8;
+
+    // prefix counts and value sums: P[i], S[i] cover bins [0, i)
+    double P[MXGRAY + 1], S[MXGRAY + 1];
+    P[0] = S[0] = 0.0;
+    for (int v = 0; v < MXGRAY; ++v) {
+        P[v + 1] = P[v] + (double)H[v];
+        S[v + 1] = S[v] + (double)H[v] * v;
+    }
+    auto score = [&](int a, int b) {
+        double p = P[b] - P[a], s = S[b] - S[a];
+        return (p > 0.0) ? s * s / p : 0.0;
+    };
+
+    // best[m][b]: best score of m classes covering bins [0, b); from[m][b]: start of last class
+    std::vector<std::vector<double>> best(levels + 1, std::vector<double>(MXGRAY + 1, -1.0));
+    std::vector<std::vector<int>> from(levels + 1, std::vector<int>(MXGRAY + 1, 0));
+    for (int b = 1; b <= MXGRAY; ++b) best[1][b] = score(0, b);
+    for (int m = 2; m <= levels; ++m) {
+        for (int b = m; b <= MXGRAY; ++b) {
+            for (int a = m - 1; a < b; ++a) {
+                double v = best[m - 1][a] + score(a, b);
+                if (v > best[m][b]) {
+                    best[m][b] = v;
+                    from[m][b] = a;
+                }
+            }
+        }
+    }
+
+    // backtrack class boundaries
+    int b = MXGRAY;
+    for (int m = levels; m >= 2; --m) {
+        b = from[m][b];
+        thr[m - 2] = b;
+    }
+    return levels;
+}
+
+int HW_otsuThreshold(const long long H[MXGRAY]) {
+    int thr[1];
+    HW_multiOtsuThresholds(H, 2, thr);
+    return thr[0];
+}
+
+int HW_percentile(const long long H[MXGRAY], double pct) {
+    long long n = 0;
+    for (int v = 0; v < MXGRAY; ++v) n += H[v];
+    if (n == 0) return 0;
+
+    const double target = pct / 100.0 * (double)n;
+    long long run = 0;
+    for (int v = 0; v < MXGRAY; ++v) {
+        run += H[v];
+        if ((double)run >= target) return v;
+    }
+    return MaxGray;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_lloydMax:
+//
+// The cells of an optimal 1-D quantizer are contiguous, so dynamic
+// programming over the d occupied bins finds the cells of minimum squared
+// error exactly in O(levels * d^2): the error of a cell is Q - S^2/P with
+// prefix counts P, value sums S and squared sums Q (the same objective as
+// HW_multiOtsuThresholds). Every cell then holds pixels, so no level is
+// wasted. Lloyd-Max iterations from that solution, where cells are
+// bounded by the midpoints between neighboring representatives and each
+// representative is the mean of its cell, place the empty bins between
+// the cells with the nearest representative without raising the error.
+//
+
+// cells [b[k], b[k+1]) of bins with representatives rep[k]; returns the squared error
+static double lloydMaxFrom(const double P[], const double S[], const double Q[],
+                           int levels, std::vector<int>& b, std::vector<double>& rep) {
+    auto error = [&]() {
+        double e = 0.0;
+        for (int k = 0; k < levels; ++k) {
+            const double p = P[b[k + 1]] - P[b[k]], s = S[b[k + 1]] - S[b[k]];
+            e += Q[b[k + 1]] - Q[b[k]] - 2.0 * rep[k] * s + rep[k] * rep[k] * p;
+        }
+        return e;
+    };
+
+    for (int iter = 0; iter < 4 * MXGRAY; ++iter) {
+        // representative: mean of the cell (an empty cell keeps its value)
+        for (int k = 0; k < levels; ++k) {
+            const double p = P[b[k + 1]] - P[b[k]];
+            if (p > 0.0) rep[k] = (S[b[k + 1]] - S[b[k]]) / p;
+        }
+
+        // cell boundary: first bin at or above the midpoint of two representatives
+        bool changed = false;
+        for (int k = 1; k < levels; ++k) {
+            int nb = (int)std::ceil(0.5 * (rep[k - 1] + rep[k]));
+            nb = std::max(b[k - 1], std::min(nb, (int)MXGRAY));
+            if (nb != b[k]) {
+                b[k] = nb;
+                changed = true;
+            }
+        }
+        if (!changed) break;
+    }
+    return error();
+}
+
+double HW_lloydMax(const long long H[MXGRAY], int levels, double rep[], int level[MXGRAY]) {
+    if (levels < 2) levels = 2;
+    if (levels > MXGRAY) levels = MXGRAY;
+
+    // prefix counts, value sums and squared sums over bins [0, i)
+    double P[MXGRAY + 1], S[MXGRAY + 1], Q[MXGRAY + 1];
+    P[0] = S[0] = Q[0] = 0.0;
+    for (int v = 0; v < MXGRAY; ++v) {
+        P[v + 1] = P[v] + (double)H[v];
+        S[v + 1] = S[v] + (double)H[v] * v;
+        Q[v + 1] = Q[v] + (double)H[v] * v * v;
+    }
+    const double n = P[MXGRAY];
+
+    // occupied bins u[0..d)
+    std::vector<int> u;
+    for (int v = 0; v < MXGRAY; ++v)
+        if (H[v] > 0) u.push_back(v);
+    const int d = (int)u.size();
+
+    // cells [b[k], b[k+1]) of the used levels
+    const int used = (d == 0) ? levels : std::min(d, levels);
+    std::vector<int> b(levels + 1, MXGRAY);
+    std::vector<double> r(levels, 0.0);
+    b[0] = 0;
+    if (d == 0) {
+        // no pixels: uniform cells of MXGRAY / levels bins
+        for (int k = 0; k <= levels; ++k) b[k] = (int)std::ceil((double)k * MXGRAY / levels);
+        for (int k = 0; k < levels; ++k) r[k] = 0.5 * (b[k] + b[k + 1] - 1);
+    }
+    else if (d <= levels) {
+        // one cell per occupied bin; the extra levels are empty cells at the top
+        for (int k = 1; k < d; ++k) b[k] = u[k];
+        for (int k = d; k < levels; ++k) r[k] = u[d - 1];
+    }
+    else {
+        // squared error of the cell of occupied bins [i, j)
+        auto cost = [&](int i, int j) {
+            const int lo = u[i], hi = u[j - 1] + 1;
+            const double p = P[hi] - P[lo], s = S[hi] - S[lo];
+            return Q[hi] - Q[lo] - s * s / p;
+        };
+
+        // best[m][j]: least error of m cells over occupied bins [0, j); from[m][j]: start of the last cell
+        std::vector<std::vector<double>> best(levels + 1, std::vector<double>(d + 1, HUGE_VAL));
+        std::vector<std::vector<int>> from(levels + 1, std::vector<int>(d + 1, 0));
+        for (int j = 1; j <= d; ++j) best[1][j] = cost(0, j);
+        for (int m = 2; m <= levels; ++m) {
+            for (int j = m; j <= d - (levels - m); ++j) {
+                for (int i = m - 1; i < j; ++i) {
+                    const double e = best[m - 1][i] + cost(i, j);
+                    if (e < best[m][j]) {
+                        best[m][j] = e;
+                        from[m][j] = i;
+                    }
+                }
+            }
+        }
+
+        // backtrack the cells, each starting at its first occupied bin
+        for (int m = levels, j = d; m >= 2; --m) {
+            j = from[m][j];
+            b[m - 1] = u[j];
+        }
+    }
+    for (int k = 0; k < levels; ++k) {
+        const double p = P[b[k + 1]] - P[b[k]];
+        if (p > 0.0) r[k] = (S[b[k + 1]] - S[b[k]]) / p;
+    }
+
+    const double e = lloydMaxFrom(P, S, Q, used, b, r);
+    for (int k = 0; k < levels; ++k) {
+        rep[k] = r[k];
+        for (int v = b[k]; v < b[k + 1]; ++v) level[v] = k;
+    }
+    return (n > 0.0) ? e / n : 0.0;
+}
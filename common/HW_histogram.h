@@ -0,0 +1,156 @@
+#ifndef HW_HISTOGRAM_H
+#define HW_HISTOGRAM_H
+
+#include "IP.h"
+#include <cmath>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Shared histogram kernel and histogram-driven parameter selection.
+//
+// HW_histogram() counts n uchar pixels into H (H is cleared first). It
+// spreads consecutive pixels over 4 sub-histograms so that runs of equal
+// values do not serialize on one counter, and splits large inputs over
+// threads.
+//
+// The selection functions only read the 256-bin histogram, so choosing
+// thr or t1/t2 costs one histogram pass, and the operator then applies
+// its LUT in one more pass.
+//
+
+void HW_histogram(const IP::uchar* p, int n, int H[IP::MXGRAY]);
+
+// 8-bit bin of a value given in 8-bit units (v / HW_pixelScale<T>())
+inline int HW_histogramBin(double v) {
+    return (v < 0.0) ? 0 : (v >= IP::MaxGray ? IP::MaxGray : (int)v);
+}
+
+// number of pixels counted into a histogram, out of the population it describes
+struct HW_HistogramSamples {
+    long long samples;
+    long long population;
+};
+
+// histogram summed over all channels of I; returns the pixels counted.
+// 16-bit and float channels are binned into 256 bins of HW_histogramBin().
+// Counts a subsample when histogram sampling is enabled (see below).
+HW_HistogramSamples HW_imageHistogram(ImagePtr I, long long H[IP::MXGRAY]);
+
+// histogram of channel ch of I alone, binned and sampled as above
+HW_HistogramSamples HW_channelHistogram(ImagePtr I, int ch, long long H[IP::MXGRAY]);
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Sampled histograms.
+//
+// Operators that only need the shape of the histogram (histoMatchApprox,
+// the Otsu and percentile modes) can estimate it from a stratified
+// subsample instead of every pixel; the LUT built from it is then applied
+// to the full image as usual. Sampling is off by default.
+//
+//   budget > 0:     about budget samples per channel, one per block of
+//                   sx x sy pixels at a fixed pseudo-random spot in the block
+//   rowStride > 1:  every pixel of one row in rowStride (overrides budget)
+//
+// Channels with fewer pixels than the budget are counted exactly. For n
+// independent random samples, the empirical CDF is within
+//   eps = sqrt(ln(2 / (1 - confidence)) / (2n))
+// of the exact CDF at every value with probability confidence (Dvoretzky-
+// Kiefer-Wolfowitz). HW_histogramCdfError() reports this eps for the
+// sample count of a histogram, but the samples above come from a fixed
+// grid and are neither random nor independent, so eps is only a heuristic
+// for the error: image structure that repeats with the block size or row
+// stride can bias the estimate well beyond it.
+//
+// The setting is per thread, like HW_threadBudget(): it applies to the
+// operators called on the thread that made it. HW_Batch and HW_Pipeline
+// hand the setting of the thread calling run() to their workers.
+//
+
+struct HW_HistogramSampling {
+    long long budget;
+    int rowStride;
+};
+
+inline HW_HistogramSampling& HW_histogramSampling() {
+    static thread_local HW_HistogramSampling s = { 0, 1 };
+    return s;
+}
+
+inline void HW_setHistogramSampling(long long budget, int rowStride = 1) {
+    HW_histogramSampling().budget = (budget < 0) ? 0 : budget;
+    HW_histogramSampling().rowStride = (rowStride < 1) ? 1 : rowStride;
+}
+
+// eps of a histogram with these samples (0 when every pixel was counted)
+double HW_histogramCdfError(const HW_HistogramSamples& s, double confidence = 0.99);
+
+// record / report the samples of the last histogram built on this thread, for
+// operators that do not return them (HW_histoMatch)
+void   HW_histogramNoteSamples(long long samples, long long population);
+double HW_histogramCdfError(double confidence = 0.99);
+
+// DKW bound on the CDF error of n samples
+double HW_cdfErrorBound(long long n, double confidence);
+
+// call fn(value) for the pixels of the w x h channel p selected by the current
+// sampling setting (all of them when sampling is off); returns the number visited
+template <class T, class Fn>
+long long HW_samplePixels(const T* p, int w, int h, Fn fn) {
+    const HW_HistogramSampling& s = HW_histogramSampling();
+    const long long total = (long long)w * h;
+
+    // one row in rowStride, starting in the middle of the first stride
+    if (s.rowStride > 1 && h > 1) {
+        long long n = 0;
+        for (int y = s.rowStride / 2 % h; y < h; y += s.rowStride, n += w)
+            for (int x = 0; x < w; ++x) fn(p[(long long)y * w + x]);
+        return n;
+    }
+
+    if (s.budget <= 0 || s.budget >= total) {
+        for (long long i = 0; i < total; ++i) fn(p[i]);
+        return total;
+    }
+
+    // blocks of sx x sy pixels, about budget of them, one sample each
+    int sx = (int)std::sqrt((double)total / s.budget);
+    if (sx < 1) sx = 1;
+    if (sx > w) sx = w;
+    int sy = (int)((double)total / ((double)s.budget * sx) + 0.5);
+    if (sy < 1) sy = 1;
+    if (sy > h) sy = h;
+
+    long long n = 0;
+    for (int by = 0; by * sy < h; ++by) {
+        const int bh = (h - by * sy < sy) ? h - by * sy : sy;
+        for (int bx = 0; bx * sx < w; ++bx, ++n) {
+            const int bw = (w - bx * sx < sx) ? w - bx * sx : sx;
+            unsigned int hash = (unsigned int)bx * 73856093u ^ (unsigned int)by * 19349663u;
+            hash ^= hash >> 13;
+            hash *= 0x5bd1e995u;
+            hash ^= hash >> 15;
+            const int x = bx * sx + (int)(hash % (unsigned int)bw);
+            const int y = by * sy + (int)((hash >> 16) % (unsigned int)bh);
+            fn(p[(long long)y * w + x]);
+        }
+    }
+    return n;
+}
+
+// Otsu threshold: value thr maximizing between-class variance of [0,thr) and [thr,255]
+int HW_otsuThreshold(const long long H[IP::MXGRAY]);
+
+// multi-level Otsu: levels classes separated by levels-1 thresholds written to thr[]
+// (class k is [thr[k-1], thr[k]) ); levels is clamped to [2, 8]
+int HW_multiOtsuThresholds(const long long H[IP::MXGRAY], int levels, int thr[]);
+
+// smallest value v such that at least pct percent of the pixels are <= v
+int HW_percentile(const long long H[IP::MXGRAY], double pct);
+
+// minimum squared error quantizer of the bins (optimal 1-D k-means, refined by
+// Lloyd-Max): levels representatives rep[k] in bin units, ascending, and the
+// index level[v] of the cell of each bin v; levels is clamped to [2, 256];
+// with fewer occupied bins than levels the extra representatives repeat the
+// top one; returns the mean squared error per pixel
+double HW_lloydMax(const long long H[IP::MXGRAY], int levels, double rep[], int level[IP::MXGRAY]);
+
+#endif
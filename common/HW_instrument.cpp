@@ -0,0 +1,179 @@
+#include "HW_instrument.h"
+
+#ifdef HW_INSTRUMENT
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// one completed operator call, kept for the Chrome trace
+struct TraceEvent {
+    const char* name;
+    int         tid;
+    long long   startNs, durNs;
+};
+
+static const size_t MaxTraceEvents = 1 << 20;
+
+static std::mutex                             g_mutex;
+static std::map<std::string, HW_ProfileStats> g_stats;
+static std::vector<TraceEvent>                g_trace;
+static std::map<std::thread::id, int>         g_threadIds;
+static const Clock::time_point                g_epoch = Clock::now();
+
+// innermost active operator call of this thread
+static thread_local HW_ProfileScope* t_current = nullptr;
+
+static long long nanos(Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count();
+}
+
+// small sequential id per thread (called with g_mutex held)
+static int threadId() {
+    auto it = g_threadIds.find(std::this_thread::get_id());
+    if (it != g_threadIds.end()) return it->second;
+    int id = (int)g_threadIds.size();
+    g_threadIds[std::this_thread::get_id()] = id;
+    return id;
+}
+
+HW_ProfileScope::HW_ProfileScope(const char* name, long long pixels, long long bytes)
+    : m_name(name), m_pixels(pixels), m_bytes(bytes), m_allocs(0), m_allocBytes(0),
+      m_threads(1), m_busyNs(0), m_parent(t_current) {
+    t_current = this;
+    m_start = Clock::now();
+}
+
+HW_ProfileScope::~HW_ProfileScope() {
+    Clock::time_point end = Clock::now();
+    long long ns = nanos(m_start, end);
+    t_current = m_parent;
+
+    int bucket = 0;
+    while (bucket < 63 && (1LL << (bucket + 1)) <= ns) ++bucket;
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    auto it = g_stats.find(m_name);
+    if (it == g_stats.end()) {
+        HW_ProfileStats s;
+        std::memset(&s, 0, sizeof(s));
+        s.minNs = ns;
+        it = g_stats.insert(std::make_pair(std::string(m_name), s)).first;
+    }
+
+    HW_ProfileStats& s = it->second;
+    s.calls++;
+    s.totalNs += ns;
+    if (ns < s.minNs) s.minNs = ns;
+    if (ns > s.maxNs) s.maxNs = ns;
+    s.pixels += m_pixels;
+    s.bytes += m_bytes;
+    s.allocs += m_allocs;
+    s.allocBytes += m_allocBytes;
+    if (m_threads > 1) {
+        s.busyNs += m_busyNs.load();
+        s.capacityNs += ns * m_threads;
+    }
+    s.histo[bucket]++;
+
+    if (g_trace.size() < MaxTraceEvents)
+        g_trace.push_back({ m_name, threadId(), nanos(g_epoch, m_start), ns });
+}
+
+HW_ProfileWorker::HW_ProfileWorker(HW_ProfileScope* scope) : m_scope(scope), m_start(Clock::now()) {}
+
+HW_ProfileWorker::~HW_ProfileWorker() {
+    if (m_scope) m_scope->m_busyNs += nanos(m_start, Clock::now());
+}
+
+HW_ProfileScope* HW_profileCurrent() {
+    return t_current;
+}
+
+void HW_profileAlloc(long long bytes) {
+    if (!t_current) return;
+    t_current->m_allocs++;
+    t_current->m_allocBytes += bytes;
+}
+
+void HW_profileThreads(int n) {
+    if (t_current) t_current->m_threads = n;
+}
+
+bool HW_profileStats(const char* name, HW_ProfileStats& stats) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    auto it = g_stats.find(name);
+    if (it == g_stats.end()) return false;
+    stats = it->second;
+    return true;
+}
+
+void HW_profileReset() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_stats.clear();
+    g_trace.clear();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_profileDumpJSON:
+//
+// Write {"<operator>": {calls, total_ns, ..., "histogram_log2_ns": [...]}, ...}
+// Thread utilization is busy worker time / (wall time * threads) of threaded calls.
+//
+bool HW_profileDumpJSON(const char* path) {
+    FILE* fp = std::fopen(path, "w");
+    if (!fp) return false;
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::fprintf(fp, "{\n");
+    size_t n = 0;
+    for (const auto& kv : g_stats) {
+        const HW_ProfileStats& s = kv.second;
+        double util = s.capacityNs ? (double)s.busyNs / (double)s.capacityNs : 1.0;
+
+        std::fprintf(fp, "  \"%s\": {\"calls\": %lld, \"total_ns\": %lld, \"min_ns\": %lld, \"max_ns\": %lld, "
+                         "\"pixels\": %lld, \"bytes\": %lld, \"allocs\": %lld, \"alloc_bytes\": %lld, "
+                         "\"thread_utilization\": %.3f, \"histogram_log2_ns\": [",
+                     kv.first.c_str(), s.calls, s.totalNs, s.minNs, s.maxNs,
+                     s.pixels, s.bytes, s.allocs, s.allocBytes, util);
+
+        // trim trailing empty buckets
+        int last = 63;
+        while (last > 0 && !s.histo[last]) --last;
+        for (int k = 0; k <= last; ++k) std::fprintf(fp, k ? ", %lld" : "%lld", s.histo[k]);
+        std::fprintf(fp, "]}%s\n", (++n < g_stats.size()) ? "," : "");
+    }
+    std::fprintf(fp, "}\n");
+    std::fclose(fp);
+    return true;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_profileDumpTrace:
+//
+// Write recorded calls as complete ("X") events of the Chrome trace format.
+//
+bool HW_profileDumpTrace(const char* path) {
+    FILE* fp = std::fopen(path, "w");
+    if (!fp) return false;
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::fprintf(fp, "{\"traceEvents\": [\n");
+    for (size_t i = 0; i < g_trace.size(); ++i) {
+        const TraceEvent& e = g_trace[i];
+        std::fprintf(fp, "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}%s\n",
+                     e.name, e.tid, e.startNs / 1000.0, e.durNs / 1000.0,
+                     (i + 1 < g_trace.size()) ? "," : "");
+    }
+    std::fprintf(fp, "]}\n");
+    std::fclose(fp);
+    return true;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef HW_INSTRUMENT_H
+#define HW_INSTRUMENT_H
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Opt-in hot-path instrumentation for the HW_* operators.
+//
+// Compile with -DHW_INSTRUMENT to enable. Otherwise every macro below
+// expands to nothing and the query functions are empty inline stubs.
+//
+//   HW_PROFILE(name, pixels, bytes)  time the enclosing scope as one operator call
+//   HW_PROFILE_ALLOC(bytes)          count a temporary buffer of the current call
+//   HW_PROFILE_THREADS(n)            the current call fans out to n threads
+//   HW_PROFILE_WORKER(scope)         time a worker's share of call scope
+//                                    (scope obtained with HW_profileCurrent())
+//
+// Stats are aggregated per operator name, with a log2 histogram of the
+// wall time in nanoseconds, and can be queried or dumped as JSON or as a
+// Chrome trace file (chrome://tracing, Perfetto).
+//
+
+struct HW_ProfileStats {
+    long long calls;
+    long long totalNs, minNs, maxNs;
+    long long pixels;           // pixels processed
+    long long bytes;            // bytes read + written
+    long long allocs;           // temporary buffers
+    long long allocBytes;
+    long long busyNs;           // summed worker time of threaded calls
+    long long capacityNs;       // summed wall time * threads of threaded calls
+    long long histo[64];        // histo[k]: calls with wall time in [2^k, 2^(k+1)) ns
+};
+
+#ifdef HW_INSTRUMENT
+
+#include <atomic>
+#include <chrono>
+
+class HW_ProfileScope {
+public:
+    HW_ProfileScope(const char* name, long long pixels, long long bytes);
+    ~HW_ProfileScope();
+
+    const char*  m_name;
+    long long    m_pixels, m_bytes;
+    long long    m_allocs, m_allocBytes;
+    int          m_threads;
+    std::atomic<long long> m_busyNs;
+    std::chrono::steady_clock::time_point m_start;
+    HW_ProfileScope* m_parent;
+};
+
+class HW_ProfileWorker {
+public:
+    explicit HW_ProfileWorker(HW_ProfileScope* scope);
+    ~HW_ProfileWorker();
+private:
+    HW_ProfileScope* m_scope;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+HW_ProfileScope* HW_profileCurrent();
+void HW_profileAlloc(long long bytes);
+void HW_profileThreads(int n);
+
+bool HW_profileStats(const char* name, HW_ProfileStats& stats);
+void HW_profileReset();
+bool HW_profileDumpJSON(const char* path);
+bool HW_profileDumpTrace(const char* path);
+
+#define HW_PROFILE_CAT2(a, b)       a##b
+#define HW_PROFILE_CAT(a, b)        HW_PROFILE_CAT2(a, b)
+#define HW_PROFILE(name, pixels, bytes) \
+    HW_ProfileScope HW_PROFILE_CAT(hwProfileScope_, __LINE__)(name, (long long)(pixels), (long long)(bytes))
+#define HW_PROFILE_ALLOC(bytes)     HW_profileAlloc((long long)(bytes))
+#define HW_PROFILE_THREADS(n)       HW_profileThreads(n)
+#define HW_PROFILE_WORKER(scope)    HW_ProfileWorker HW_PROFILE_CAT(hwProfileWorker_, __LINE__)(scope)
+
+#else
+
+class HW_ProfileScope;
+inline HW_ProfileScope* HW_profileCurrent() { return 0; }
+inline bool HW_profileStats(const char*, HW_ProfileStats&) { return false; }
+inline void HW_profileReset() {}
+inline bool HW_profileDumpJSON(const char*) { return false; }
+inline bool HW_profileDumpTrace(const char*) { return false; }
+
+// arguments are still evaluated, so locals that only feed them stay used
+#define HW_PROFILE(name, pixels, bytes) do { (void)(name); (void)(pixels); (void)(bytes); } while (0)
+#define HW_PROFILE_ALLOC(bytes)     do { (void)(bytes); } while (0)
+#define HW_PROFILE_THREADS(n)       do { (void)(n); } while (0)
+#define HW_PROFILE_WORKER(scope)    do { (void)(scope); } while (0)
+
+#endif
+
+#endif
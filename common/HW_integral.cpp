@@ -0,0 +1,145 @@
+#include "IP.h"
+#include "HW_integral.h"
+#include "HW_parallel.h"
+#include <algorithm>
+using namespace IP;
+
+// replicate-padded prefix sums of one source row into dst[0..w+2*padX]
+template <class Acc, bool Square>
+static void prefixRow(const uchar* s, int w, int padX, const Acc* above, Acc* dst) {
+    Acc run = 0;
+    int px = 0;
+    dst[0] = 0;
+
+    const Acc left  = Square ? (Acc)s[0] * s[0] : (Acc)s[0];
+    const Acc right = Square ? (Acc)s[w - 1] * s[w - 1] : (Acc)s[w - 1];
+    for (int x = 0; x < padX; ++x, ++px) { run += left; dst[px + 1] = run; }
+    for (int x = 0; x < w; ++x, ++px) {
+        const Acc v = s[x];
+        run += Square ? v * v : v;
+        dst[px + 1] = run;
+    }
+    for (int x = 0; x < padX; ++x, ++px) { run += right; dst[px + 1] = run; }
+
+    if (above)
+        for (int i = 1; i <= px; ++i) dst[i] += above[i];
+}
+
+// build the (w+2*padX+1) x (h+2*padY+1) table T
+template <class Acc, bool Square>
+static void buildTable(const uchar* src, int w, int h, int padX, int padY, std::vector<Acc>& T) {
+    const int pw = w + 2 * padX;
+    const int ph = h + 2 * padY;
+    const int stride = pw + 1;
+    T.assign((size_t)stride * (ph + 1), 0);
+
+    // pass 1: every band builds the table of its own rows, starting from zero
+    std::vector<char> bandTop(ph + 1, 0);
+    HW_parallelFor(0, ph, 64, [&](int lo, int hi) {
+        bandTop[lo] = 1;
+        for (int py = lo; py < hi; ++py) {
+            int y = std::min(std::max(py - padY, 0), h - 1);
+            const Acc* above = (py == lo) ? nullptr : &T[(size_t)py * stride];
+            prefixRow<Acc, Square>(src + (size_t)y * w, w, padX, above, &T[(size_t)(py + 1) * stride]);
+        }
+    });
+
+    std::vector<int> starts;
+    for (int py = 0; py < ph; ++py)
+        if (bandTop[py]) starts.push_back(py);
+    starts.push_back(ph);
+    const int bands = (int)starts.size() - 1;
+    if (bands <= 1) return;
+
+    // carry[k] = final value of the table row just above band k
+    std::vector<Acc> carry((size_t)bands * stride, 0);
+    for (int k = 1; k < bands; ++k) {
+        const Acc* prev = &carry[(size_t)(k - 1) * stride];
+        const Acc* last = &T[(size_t)starts[k] * stride];
+        Acc* c = &carry[(size_t)k * stride];
+        for (int i = 0; i < stride; ++i) c[i] = prev[i] + last[i];
+    }
+
+    // pass 2: add the carry row to every row of its band
+    HW_parallelFor(1, bands, 1, [&](int lo, int hi) {
+        for (int k = lo; k < hi; ++k) {
+            const Acc* c = &carry[(size_t)k * stride];
+            for (int py = starts[k]; py < starts[k + 1]; ++py) {
+                Acc* row = &T[(size_t)(py + 1) * stride];
+                for (int i = 0; i < stride; ++i) row[i] += c[i];
+            }
+        }
+    });
+}
+
+template <class Acc>
+static inline unsigned long long rectSum(const std::vector<Acc>& T, int stride, int x0, int y0, int x1, int y1) {
+    // unsigned arithmetic: intermediate wraparound cancels out
+    Acc s = T[(size_t)(y1 + 1) * stride + x1 + 1] - T[(size_t)y0 * stride + x1 + 1]
+          - T[(size_t)(y1 + 1) * stride + x0] + T[(size_t)y0 * stride + x0];
+    return (unsigned long long)s;
+}
+
+HW_IntegralImage::HW_IntegralImage()
+    : m_w(0), m_h(0), m_padX(0), m_padY(0), m_stride(0), m_wideSum(false), m_wideSq(false) {}
+
+void HW_IntegralImage::build(const uchar* src, int w, int h, int padX, int padY, bool squares) {
+    m_w = w;
+    m_h = h;
+    m_padX = std::max(padX, 0);
+    m_padY = std::max(padY, 0);
+    m_stride = w + 2 * m_padX + 1;
+    m_sum32.clear(); m_sum64.clear();
+    m_sq32.clear();  m_sq64.clear();
+    if (w <= 0 || h <= 0) return;
+
+    // pick accumulator width from the largest possible rectangle sum
+    const unsigned long long area = (unsigned long long)(w + 2 * m_padX) * (h + 2 * m_padY);
+    m_wideSum = area * MaxGray > 0xFFFFFFFFULL;
+    m_wideSq  = area * MaxGray * MaxGray > 0xFFFFFFFFULL;
+
+    if (m_wideSum) buildTable<unsigned long long, false>(src, w, h, m_padX, m_padY, m_sum64);
+    else           buildTable<unsigned int, false>(src, w, h, m_padX, m_padY, m_sum32);
+
+    if (!squares) return;
+    if (m_wideSq) buildTable<unsigned long long, true>(src, w, h, m_padX, m_padY, m_sq64);
+    else          buildTable<unsigned int, true>(src, w, h, m_padX, m_padY, m_sq32);
+}
+
+bool HW_IntegralImage::corners(int& x0, int& y0, int& x1, int& y1) const {
+    x0 = std::max(x0, -m_padX) + m_padX;
+    y0 = std::max(y0, -m_padY) + m_padY;
+    x1 = std::min(x1, m_w - 1 + m_padX) + m_padX;
+    y1 = std::min(y1, m_h - 1 + m_padY) + m_padY;
+    return x0 <= x1 && y0 <= y1;
+}
+
+unsigned long long HW_IntegralImage::sum(int x0, int y0, int x1, int y1) const {
+    if (m_sum32.empty() && m_sum64.empty()) return 0;
+    if (!corners(x0, y0, x1, y1)) return 0;
+    return m_wideSum ? rectSum(m_sum64, m_stride, x0, y0, x1, y1)
+                     : rectSum(m_sum32, m_stride, x0, y0, x1, y1);
+}
+
+unsigned long long HW_IntegralImage::sumSq(int x0, int y0, int x1, int y1) const {
+    if (m_sq32.empty() && m_sq64.empty()) return 0;
+    if (!corners(x0, y0, x1, y1)) return 0;
+    return m_wideSq ? rectSum(m_sq64, m_stride, x0, y0, x1, y1)
+                    : rectSum(m_sq32, m_stride, x0, y0, x1, y1);
+}
+
+double HW_IntegralImage::mean(int x0, int y0, int x1, int y1) const {
+    int cx0 = x0, cy0 = y0, cx1 = x1, cy1 = y1;
+    if (!corners(cx0, cy0, cx1, cy1)) return 0.0;
+    const double area = (double)(cx1 - cx0 + 1) * (cy1 - cy0 + 1);
+    return (double)sum(x0, y0, x1, y1) / area;
+}
+
+double HW_IntegralImage::variance(int x0, int y0, int x1, int y1) const {
+    int cx0 = x0, cy0 = y0, cx1 = x1, cy1 = y1;
+    if (!corners(cx0, cy0, cx1, cy1)) return 0.0;
+    const double area = (double)(cx1 - cx0 + 1) * (cy1 - cy0 + 1);
+    const double m = (double)sum(x0, y0, x1, y1) / area;
+    const double v = (double)sumSq(x0, y0, x1, y1) / area - m * m;
+    return (v > 0.0) ? v : 0.0;
+}
@@ -0,0 +1,54 @@
+#ifndef HW_INTEGRAL_H
+#define HW_INTEGRAL_H
+
+#include "IP.h"
+#include <vector>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_IntegralImage:
+//
+// Summed-area table (and optional squared-value table) of one uchar channel.
+// S(x,y) = sum of all pixels above and to the left of (x,y), so the sum over
+// any rectangle is S(x1+1,y1+1) - S(x0,y1+1) - S(x1+1,y0) + S(x0,y0): O(1)
+// per query regardless of the rectangle size.
+//
+// The source is replicate-padded by (padX, padY) pixels on each side, so
+// rectangles reaching up to pad pixels outside the image see the same
+// border replication as HW_blur and HW_median. Coordinates beyond the
+// padding are clamped.
+//
+// The tables use unsigned 32-bit accumulators when the largest possible
+// rectangle sum fits in 32 bits, and 64-bit ones otherwise. Unsigned
+// wraparound cancels in the four-corner difference, so only the rectangle
+// sum (not the running table value) has to fit.
+//
+// Tables are built in one pass over the source, in parallel row bands.
+//
+class HW_IntegralImage {
+public:
+    HW_IntegralImage();
+
+    void build(const IP::uchar* src, int w, int h, int padX = 0, int padY = 0, bool squares = false);
+
+    int width()  const { return m_w; }
+    int height() const { return m_h; }
+
+    // rectangle [x0,x1] x [y0,y1], inclusive, in image coordinates
+    unsigned long long sum  (int x0, int y0, int x1, int y1) const;
+    unsigned long long sumSq(int x0, int y0, int x1, int y1) const;
+    double mean    (int x0, int y0, int x1, int y1) const;
+    double variance(int x0, int y0, int x1, int y1) const;
+
+private:
+    // clamp a rectangle to the padded area and convert to table corners
+    bool corners(int& x0, int& y0, int& x1, int& y1) const;
+
+    int  m_w, m_h;              // image size
+    int  m_padX, m_padY;
+    int  m_stride;              // table row length = w + 2*padX + 1
+    bool m_wideSum, m_wideSq;   // 64-bit tables
+    std::vector<unsigned int>       m_sum32, m_sq32;
+    std::vector<unsigned long long> m_sum64, m_sq64;
+};
+
+#endif
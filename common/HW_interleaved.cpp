@@ -0,0 +1,400 @@
+#include "IP.h"
+#include "HW_interleaved.h"
+#include "HW_histogram.h"
+#include "HW_instrument.h"
+#include "HW_parallel.h"
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+using namespace IP;
+
+void HW_histoMatchLut(const int H[MXGRAY], ImagePtr targetHisto, uchar lut[MXGRAY]);
+
+static inline int clampIndex(int v, int n) {
+    return (v < 0) ? 0 : (v >= n ? n - 1 : v);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// deinterleave / interleave
+//
+
+#if defined(__SSSE3__)
+// pshufb masks for 16 RGB pixels (48 bytes in 3 blocks of 16):
+// de[p][b] gathers plane p bytes from block b, in[b][p] scatters plane p into block b
+struct Shuffle3 {
+    __m128i de[3][3];
+    __m128i in[3][3];
+};
+
+static const Shuffle3& shuffle3() {
+    static const Shuffle3 masks = []() {
+        Shuffle3 t;
+        alignas(16) signed char m[16];
+        for (int p = 0; p < 3; ++p) {
+            for (int b = 0; b < 3; ++b) {
+                for (int k = 0; k < 16; ++k) {
+                    int i = 3 * k + p - 16 * b;
+                    m[k] = (i >= 0 && i < 16) ? (signed char)i : (signed char)-128;
+                }
+                t.de[p][b] = _mm_load_si128((const __m128i*)m);
+
+                for (int j = 0; j < 16; ++j) {
+                    int g = 16 * b + j;
+                    m[j] = (g % 3 == p) ? (signed char)(g / 3) : (signed char)-128;
+                }
+                t.in[b][p] = _mm_load_si128((const __m128i*)m);
+            }
+        }
+        return t;
+    }();
+    return masks;
+}
+#endif
+
+static void deinterleaveRow(const uchar* s, int n, int C, uchar* const planes[]) {
+    int x = 0;
+#if defined(__SSSE3__)
+    if (C == 3) {
+        const Shuffle3& m = shuffle3();
+        for (; x + 16 <= n; x += 16) {
+            __m128i blk[3];
+            for (int b = 0; b < 3; ++b) blk[b] = _mm_loadu_si128((const __m128i*)(s + 3 * x + 16 * b));
+            for (int p = 0; p < 3; ++p) {
+                __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(blk[0], m.de[p][0]),
+                                                      _mm_shuffle_epi8(blk[1], m.de[p][1])),
+                                         _mm_shuffle_epi8(blk[2], m.de[p][2]));
+                _mm_storeu_si128((__m128i*)(planes[p] + x), v);
+            }
+        }
+    }
+#endif
+    for (; x < n; ++x)
+        for (int c = 0; c < C; ++c) planes[c][x] = s[x * C + c];
+}
+
+static void interleaveRow(const uchar* const planes[], int n, int C, uchar* d) {
+    int x = 0;
+#if defined(__SSSE3__)
+    if (C == 3) {
+        const Shuffle3& m = shuffle3();
+        for (; x + 16 <= n; x += 16) {
+            __m128i pl[3];
+            for (int p = 0; p < 3; ++p) pl[p] = _mm_loadu_si128((const __m128i*)(planes[p] + x));
+            for (int b = 0; b < 3; ++b) {
+                __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(pl[0], m.in[b][0]),
+                                                      _mm_shuffle_epi8(pl[1], m.in[b][1])),
+                                         _mm_shuffle_epi8(pl[2], m.in[b][2]));
+                _mm_storeu_si128((__m128i*)(d + 3 * x + 16 * b), v);
+            }
+        }
+    }
+#endif
+    for (; x < n; ++x)
+        for (int c = 0; c < C; ++c) d[x * C + c] = planes[c][x];
+}
+
+ImagePtr HW_deinterleave(const HW_Interleaved& src) {
+    const int w = src.width, h = src.height, C = src.channels;
+    HW_PROFILE("HW_deinterleave", (long long)w * h * C, 2LL * w * h * C);
+
+    // ImagePtr holds BW_IMAGE or RGB_IMAGE only
+    if (C != 1 && C != 3) {
+        fprintf(stderr, "HW_deinterleave: %d channels (1 or 3 supported)\n", C);
+        return ImagePtr();
+    }
+
+    ImagePtr I = IP_allocImage(w, h, (C == 1) ? BW_IMAGE : RGB_IMAGE);
+    uchar* planes[3];
+    ChannelPtr<uchar> p;
+    int type;
+    for (int c = 0; c < C; ++c) {
+        IP_getChannel(I, c, p, type);
+        planes[c] = p;
+    }
+
+    HW_parallelFor(0, h, 64, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            uchar* rows[3];
+            for (int c = 0; c < C; ++c) rows[c] = planes[c] + y * w;
+            deinterleaveRow(src.data + (long long)y * src.stride, w, C, rows);
+        }
+    });
+    return I;
+}
+
+void HW_interleave(ImagePtr I, const HW_Interleaved& dst) {
+    const int w = I->width(), h = I->height(), C = dst.channels;
+    HW_PROFILE("HW_interleave", (long long)w * h * C, 2LL * w * h * C);
+
+    if ((C != 1 && C != 3) || I->maxDepth() != C) {
+        fprintf(stderr, "HW_interleave: %d channels for a %d-channel image (1 or 3 supported)\n", C, I->maxDepth());
+        return;
+    }
+
+    const uchar* planes[3];
+    ChannelPtr<uchar> p;
+    int type;
+    for (int c = 0; c < C; ++c) {
+        IP_getChannel(I, c, p, type);
+        planes[c] = p;
+    }
+
+    HW_parallelFor(0, h, 64, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uchar* rows[3];
+            for (int c = 0; c < C; ++c) rows[c] = planes[c] + y * w;
+            interleaveRow(rows, w, C, dst.data + (long long)y * dst.stride);
+        }
+    });
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// point operators and histograms
+//
+
+void HW_pointOpLut(const std::function<void(ImagePtr, ImagePtr)>& op, uchar lut[MXGRAY]) {
+    ImagePtr ramp = IP_allocImage(MXGRAY, 1, BW_IMAGE), out;
+    ChannelPtr<uchar> p;
+    int type;
+    IP_getChannel(ramp, 0, p, type);
+    for (int i = 0; i < MXGRAY; ++i) p[i] = (uchar)i;
+
+    op(ramp, out);
+    IP_getChannel(out, 0, p, type);
+    for (int i = 0; i < MXGRAY; ++i) lut[i] = p[i];
+}
+
+void HW_interleavedLut(const HW_Interleaved& src, const uchar* const luts[], const HW_Interleaved& dst) {
+    const int w = src.width, C = src.channels;
+    const long long pixels = (long long)w * src.height * C;
+    HW_PROFILE("HW_interleavedLut", pixels, 2 * pixels);
+
+    HW_parallelFor(0, src.height, 64, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uchar* s = src.data + (long long)y * src.stride;
+            uchar* d = dst.data + (long long)y * dst.stride;
+            if (C == 3) {
+                const uchar *l0 = luts[0], *l1 = luts[1], *l2 = luts[2];
+                for (int x = 0; x < 3 * w; x += 3) {
+                    d[x]     = l0[s[x]];
+                    d[x + 1] = l1[s[x + 1]];
+                    d[x + 2] = l2[s[x + 2]];
+                }
+                continue;
+            }
+            for (int x = 0; x < w; ++x)
+                for (int c = 0; c < C; ++c) d[x * C + c] = luts[c][s[x * C + c]];
+        }
+    });
+}
+
+void HW_interleavedHistogram(const HW_Interleaved& src, int H[][MXGRAY]) {
+    const int w = src.width, C = src.channels;
+    const long long pixels = (long long)w * src.height * C;
+    HW_PROFILE("HW_interleavedHistogram", pixels, pixels);
+
+    // a single contiguous channel is the planar case
+    if (C == 1 && src.stride == w) {
+        HW_histogram(src.data, w * src.height, H[0]);
+        return;
+    }
+
+    std::memset(H, 0, C * sizeof(H[0]));
+    std::mutex merge;
+    HW_parallelFor(0, src.height, 256, [&](int y0, int y1) {
+        // neighboring bytes belong to different channels, so one table per channel suffices
+        std::vector<int> local(C * MXGRAY, 0);
+        for (int y = y0; y < y1; ++y) {
+            const uchar* s = src.data + (long long)y * src.stride;
+            if (C == 3) {
+                int *h0 = &local[0], *h1 = &local[MXGRAY], *h2 = &local[2 * MXGRAY];
+                for (int x = 0; x < 3 * w; x += 3) {
+                    ++h0[s[x]];
+                    ++h1[s[x + 1]];
+                    ++h2[s[x + 2]];
+                }
+                continue;
+            }
+            for (int x = 0; x < w; ++x)
+                for (int c = 0; c < C; ++c) ++local[c * MXGRAY + s[x * C + c]];
+        }
+
+        std::lock_guard<std::mutex> lock(merge);
+        for (int c = 0; c < C; ++c)
+            for (int v = 0; v < MXGRAY; ++v) H[c][v] += local[c * MXGRAY + v];
+    });
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_interleavedHistoMatch:
+//
+// One pass for all channel histograms, one pass to apply the per-channel
+// CDF matching LUTs. Same output as histoMatchApprox() on the planar image.
+//
+void HW_interleavedHistoMatch(const HW_Interleaved& src, ImagePtr targetHisto, const HW_Interleaved& dst) {
+    const int C = src.channels;
+    if (C < 1 || C > 4) {
+        fprintf(stderr, "HW_interleavedHistoMatch: %d channels (1 to 4 supported)\n", C);
+        return;
+    }
+
+    int H[4][MXGRAY];
+    uchar lut[4][MXGRAY];
+    const uchar* luts[4];
+
+    HW_interleavedHistogram(src, H);
+    for (int c = 0; c < C; ++c) {
+        HW_histoMatchLut(H[c], targetHisto, lut[c]);
+        luts[c] = lut[c];
+    }
+    HW_interleavedLut(src, luts, dst);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_interleavedBlur:
+//
+// Box filter in one sweep over the source. Each row band keeps the
+// horizontally averaged rows of the current window in a ring of filterH
+// rows and a running column sum over the ring, so every source row is
+// averaged once and every output row costs one add and one subtract per
+// sample. Both averages truncate, exactly as in HW_blur's two passes.
+//
+void HW_interleavedBlur(const HW_Interleaved& src, int filterW, int filterH, const HW_Interleaved& dst) {
+    // make sure filter dimensions are odd and positive
+    if (filterW < 1) filterW = 1;
+    if (filterH < 1) filterH = 1;
+    if ((filterW & 1) == 0) filterW++;
+    if ((filterH & 1) == 0) filterH++;
+
+    const int w = src.width, h = src.height, C = src.channels;
+    const int rowLen = w * C;
+    const int halfWidth = filterW / 2;
+    const int halfHeight = filterH / 2;
+    const long long pixels = (long long)w * h * C;
+    HW_PROFILE("HW_interleavedBlur", pixels, 2 * pixels);
+
+    if (C < 1 || C > 4) {
+        fprintf(stderr, "HW_interleavedBlur: %d channels (1 to 4 supported)\n", C);
+        return;
+    }
+
+    HW_parallelFor(0, h, 32, [&](int y0, int y1) {
+        std::vector<int> ring((size_t)filterH * rowLen), colSum(rowLen, 0);
+        HW_PROFILE_ALLOC(((size_t)filterH + 1) * rowLen * sizeof(int));
+
+        // horizontal average of source row clamp(s) into its ring slot
+        auto averageRow = [&](int s) {
+            const uchar* r = src.data + (long long)clampIndex(s, h) * src.stride;
+            int* out = &ring[(size_t)((s + halfHeight) % filterH) * rowLen];
+            int sum[4] = { 0, 0, 0, 0 };
+            for (int dx = -halfWidth; dx <= halfWidth; ++dx) {
+                const uchar* p = r + clampIndex(dx, w) * C;
+                for (int c = 0; c < C; ++c) sum[c] += p[c];
+            }
+            for (int x = 0; x < w; ++x) {
+                const uchar* add = r + clampIndex(x + halfWidth + 1, w) * C;
+                const uchar* sub = r + clampIndex(x - halfWidth, w) * C;
+                for (int c = 0; c < C; ++c) {
+                    out[x * C + c] = sum[c] / filterW;
+                    sum[c] += add[c] - sub[c];
+                }
+            }
+            return out;
+        };
+
+        for (int s = y0 - halfHeight; s <= y0 + halfHeight; ++s) {
+            const int* row = averageRow(s);
+            for (int i = 0; i < rowLen; ++i) colSum[i] += row[i];
+        }
+
+        for (int y = y0; y < y1; ++y) {
+            uchar* d = dst.data + (long long)y * dst.stride;
+            for (int i = 0; i < rowLen; ++i) d[i] = (uchar)(colSum[i] / filterH);
+
+            // slide window one row down: row y+halfHeight+1 replaces row y-halfHeight in the ring
+            if (y + 1 < y1) {
+                const int s = y + halfHeight + 1;
+                const int* old = &ring[(size_t)((s + halfHeight) % filterH) * rowLen];
+                for (int i = 0; i < rowLen; ++i) colSum[i] -= old[i];
+                const int* row = averageRow(s);
+                for (int i = 0; i < rowLen; ++i) colSum[i] += row[i];
+            }
+        }
+    });
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_interleavedMedian:
+//
+// Huang's sliding-histogram median, one 256-bin histogram per channel.
+// Moving one pixel right removes the leftmost window column and adds a new
+// one (sz samples per channel), and the median is found by walking from
+// its previous value, so no sorting is needed. Same sz clamping, border
+// replication and rank (area/2) as HW_median.
+//
+void HW_interleavedMedian(const HW_Interleaved& src, int sz, const HW_Interleaved& dst) {
+    // ensure valid filter size
+    if (sz < 1) sz = 1;
+    if ((sz & 1) == 0) sz++;
+    if (sz > 9) sz = 9;
+
+    const int w = src.width, h = src.height, C = src.channels;
+    const int halfSize = sz / 2;
+    const int rank = (sz * sz) / 2;
+    const long long pixels = (long long)w * h * C;
+    HW_PROFILE("HW_interleavedMedian", pixels, pixels * (2 * sz + 1));
+
+    if (C < 1 || C > 4) {
+        fprintf(stderr, "HW_interleavedMedian: %d channels (1 to 4 supported)\n", C);
+        return;
+    }
+
+    HW_parallelFor(0, h, 16, [&](int y0, int y1) {
+        int H[4][MXGRAY];
+        const uchar* rows[9];
+
+        for (int y = y0; y < y1; ++y) {
+            for (int dy = -halfSize; dy <= halfSize; ++dy)
+                rows[dy + halfSize] = src.data + (long long)clampIndex(y + dy, h) * src.stride;
+
+            // window at x = 0
+            std::memset(H, 0, sizeof(H));
+            for (int k = 0; k < sz; ++k)
+                for (int dx = -halfSize; dx <= halfSize; ++dx) {
+                    const uchar* p = rows[k] + clampIndex(dx, w) * C;
+                    for (int c = 0; c < C; ++c) ++H[c][p[c]];
+                }
+
+            // med[c]: current median, below[c]: samples smaller than med[c]
+            int med[4] = { 0, 0, 0, 0 }, below[4] = { 0, 0, 0, 0 };
+            uchar* d = dst.data + (long long)y * dst.stride;
+            for (int x = 0; x < w; ++x) {
+                if (x > 0) {
+                    const int xs = clampIndex(x - halfSize - 1, w) * C;
+                    const int xa = clampIndex(x + halfSize, w) * C;
+                    for (int k = 0; k < sz; ++k) {
+                        for (int c = 0; c < C; ++c) {
+                            int vs = rows[k][xs + c], va = rows[k][xa + c];
+                            --H[c][vs];
+                            ++H[c][va];
+                            below[c] += (va < med[c]) - (vs < med[c]);
+                        }
+                    }
+                }
+
+                for (int c = 0; c < C; ++c) {
+                    int m = med[c], b = below[c];
+                    while (b > rank) b -= H[c][--m];
+                    while (b + H[c][m] <= rank) b += H[c][m++];
+                    med[c] = m;
+                    below[c] = b;
+                    d[x * C + c] = (uchar)m;
+                }
+            }
+        }
+    });
+}
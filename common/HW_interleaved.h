@@ -0,0 +1,65 @@
+#ifndef HW_INTERLEAVED_H
+#define HW_INTERLEAVED_H
+
+#include "IP.h"
+#include <functional>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Interleaved-layout mode for 8-bit multi-channel buffers.
+//
+// ImagePtr stores each channel as a separate plane, so the HW_* operators
+// loop over channels on the outside and rescan memory once per channel.
+// Camera buffers arrive interleaved (RGBRGB...), where that either means a
+// strided access per channel or a deinterleave copy first.
+//
+// The functions below work directly on interleaved buffers and process all
+// channels of a pixel in the same sweep, so the data is read once:
+//   HW_interleavedLut        per-channel LUT (any point operator)
+//   HW_interleavedHistogram  all channel histograms
+//   HW_interleavedHistoMatch approximate histogram matching (histoMatchApprox)
+//   HW_interleavedBlur       box filter, same output as HW_blur
+//   HW_interleavedMedian     median filter, same output as HW_median
+//
+// HW_deinterleave() / HW_interleave() convert to and from ImagePtr for the
+// remaining operators (SSSE3 shuffles for 3 channels when available).
+//
+// Buffers hold 1..4 channels for the operators below, which reject other
+// counts with a message; the conversions take 1 or 3 channels only, as
+// ImagePtr has no 2- or 4-channel layout.
+// Stride is the row length in bytes (0 = width * channels). Source and destination must not overlap, except
+// for HW_interleavedLut, which may run in place.
+//
+
+struct HW_Interleaved {
+    IP::uchar* data;
+    int width;
+    int height;
+    int channels;
+    int stride;
+};
+
+inline HW_Interleaved HW_interleaved(IP::uchar* data, int w, int h, int channels, int stride = 0) {
+    HW_Interleaved b = { data, w, h, channels, stride ? stride : w * channels };
+    return b;
+}
+
+// planar <-> interleaved for 1 or 3 channels (BW_IMAGE or RGB_IMAGE); other
+// channel counts are rejected with a message: HW_deinterleave returns a null
+// image and HW_interleave leaves dst untouched
+ImagePtr HW_deinterleave(const HW_Interleaved& src);
+void HW_interleave(ImagePtr I, const HW_Interleaved& dst);
+
+// 8-bit LUT of a point operator: its output on a 256-entry ramp
+void HW_pointOpLut(const std::function<void(ImagePtr, ImagePtr)>& op, IP::uchar lut[IP::MXGRAY]);
+
+// dst = luts[c][src] for channel c
+void HW_interleavedLut(const HW_Interleaved& src, const IP::uchar* const luts[], const HW_Interleaved& dst);
+
+// H[c] = histogram of channel c (cleared first)
+void HW_interleavedHistogram(const HW_Interleaved& src, int H[][IP::MXGRAY]);
+
+void HW_interleavedHistoMatch(const HW_Interleaved& src, ImagePtr targetHisto, const HW_Interleaved& dst);
+void HW_interleavedBlur  (const HW_Interleaved& src, int filterW, int filterH, const HW_Interleaved& dst);
+void HW_interleavedMedian(const HW_Interleaved& src, int sz, const HW_Interleaved& dst);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef HW_PARALLEL_H
+#define HW_PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "HW_instrument.h"
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Row-band parallelism for the HW_* operators.
+//
+// HW_parallelFor(begin, end, minGrain, fn) splits [begin,end) into at most
+// HW_threadCount() contiguous bands of at least minGrain items and calls
+// fn(lo, hi) for each band on its own thread. The calling thread runs the
+// first band. Small ranges run inline without spawning any thread.
+//
+// A scheduler that already runs several operators at once (HW_Batch) caps
+// the bands of the operators on one of its threads with HW_threadBudget().
+//
+
+// number of threads used by HW_parallelFor (0 = hardware concurrency)
+inline int& HW_threadSetting() {
+    static int n = 0;
+    return n;
+}
+
+inline void HW_setThreadCount(int n) {
+    HW_threadSetting() = (n < 0) ? 0 : n;
+}
+
+// per-thread cap on HW_threadCount() (0 = no cap)
+inline int& HW_threadBudget() {
+    static thread_local int n = 0;
+    return n;
+}
+
+inline int HW_threadCount() {
+    int n = HW_threadSetting();
+    if (n <= 0) n = (int)std::thread::hardware_concurrency();
+    if (n <= 0) n = 1;
+    const int budget = HW_threadBudget();
+    return (budget > 0 && budget < n) ? budget : n;
+}
+
+template <class Fn>
+void HW_parallelFor(int begin, int end, int minGrain, Fn fn) {
+    const int count = end - begin;
+    if (count <= 0) return;
+    if (minGrain < 1) minGrain = 1;
+
+    int bands = std::min(HW_threadCount(), (count + minGrain - 1) / minGrain);
+    if (bands <= 1) {
+        fn(begin, end);
+        return;
+    }
+
+    HW_PROFILE_THREADS(bands);
+    HW_ProfileScope* scope = HW_profileCurrent();
+    (void)scope;
+
+    // band k covers [begin + k*count/bands, begin + (k+1)*count/bands)
+    std::vector<std::thread> workers;
+    workers.reserve(bands - 1);
+    for (int k = 1; k < bands; ++k) {
+        int lo = begin + (int)((long long)count * k / bands);
+        int hi = begin + (int)((long long)count * (k + 1) / bands);
+        workers.emplace_back([=]() {
+            HW_PROFILE_WORKER(scope);
+            fn(lo, hi);
+        });
+    }
+    {
+        HW_PROFILE_WORKER(scope);
+        fn(begin, begin + (int)((long long)count / bands));
+    }
+    for (std::thread& t : workers) t.join();
+}
+
+#endif
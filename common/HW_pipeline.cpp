@@ -0,0 +1,164 @@
+#include "IP.h"
+#include "HW_pipeline.h"
+#include "HW_histogram.h"
+#include <chrono>
+#include <memory>
+#include <thread>
+using namespace IP;
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedMs(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// spin, then yield, then sleep until ready() succeeds; returns the time waited in ms
+template <class Fn>
+static double waitFor(Fn ready) {
+    if (ready()) return 0.0;
+
+    Clock::time_point t0 = Clock::now();
+    for (int spin = 0; !ready(); ++spin) {
+        if (spin < 64) continue;
+        if (spin < 1024) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    return elapsedMs(t0);
+}
+
+namespace {
+// a frame in flight; index < 0 marks the end of the stream
+struct Frame {
+    ImagePtr image;
+    long long index;
+};
+}
+
+HW_Pipeline::HW_Pipeline(int queueDepth)
+    : m_depth(queueDepth < 1 ? 1 : queueDepth), m_wallMs(0.0) {}
+
+void HW_Pipeline::addStage(const char* name, Op op) {
+    Stage s = { name, op };
+    m_stages.push_back(s);
+}
+
+long long HW_Pipeline::run(const std::function<bool(ImagePtr&)>& source, const std::function<void(ImagePtr)>& sink) {
+    const int n = (int)m_stages.size();
+    const int pool = m_depth + 2;
+    Clock::time_point start = Clock::now();
+
+    // channel i carries frames into stage i (channel n into the sink);
+    // back[i] returns the consumed images to the producer of channel i
+    std::vector<std::unique_ptr<HW_SpscQueue<Frame>>> fwd;
+    std::vector<std::unique_ptr<HW_SpscQueue<ImagePtr>>> back;
+    for (int i = 0; i <= n; ++i) {
+        fwd.emplace_back(new HW_SpscQueue<Frame>(m_depth));
+        back.emplace_back(new HW_SpscQueue<ImagePtr>(pool));
+    }
+    std::vector<int> allocated(n + 1, 0);   // images created by the producer of channel i
+
+    m_stats.assign(n, HW_StageStats());
+    for (int k = 0; k < n; ++k) m_stats[k].name = m_stages[k].name;
+
+    // recycled output image for the producer of channel i, or a new one while the pool is not full
+    auto acquire = [&](int i, double& waitedMs) {
+        ImagePtr img;
+        if (back[i]->pop(img)) return img;
+        if (allocated[i] < pool) {
+            allocated[i]++;
+            return ImagePtr();
+        }
+        waitedMs += waitFor([&]() { return back[i]->pop(img); });
+        return img;
+    };
+    auto endOfStream = [&](int i) {
+        Frame end = { ImagePtr(), -1 };
+        waitFor([&]() { return fwd[i]->push(end); });
+    };
+
+    std::vector<std::thread> threads;
+
+    // feeder
+    threads.emplace_back([&]() {
+        double unused = 0.0;
+        for (long long index = 0;; ++index) {
+            Frame f = { acquire(0, unused), index };
+            if (!source(f.image)) break;
+            waitFor([&]() { return fwd[0]->push(f); });
+        }
+        endOfStream(0);
+    });
+
+    // one worker per stage, with the histogram sampling of the calling thread
+    const HW_HistogramSampling sampling = HW_histogramSampling();
+    for (int k = 0; k < n; ++k) {
+        threads.emplace_back([&, k]() {
+            HW_histogramSampling() = sampling;
+            HW_StageStats& st = m_stats[k];
+            long long depthSum = 0;
+            for (;;) {
+                Frame in;
+                st.starvedMs += waitFor([&]() { return fwd[k]->pop(in); });
+                if (in.index < 0) break;
+
+                const int depth = fwd[k]->size() + 1;
+                depthSum += depth;
+                if (depth > st.maxDepth) st.maxDepth = depth;
+
+                Frame out = { acquire(k + 1, st.blockedMs), in.index };
+                Clock::time_point t0 = Clock::now();
+                m_stages[k].op(in.image, out.image);
+                const double ms = elapsedMs(t0);
+                st.busyMs += ms;
+                if (ms > st.maxMs) st.maxMs = ms;
+                st.frames++;
+
+                // at most pool images circulate per channel, so this push cannot fail
+                back[k]->push(in.image);
+                st.blockedMs += waitFor([&]() { return fwd[k + 1]->push(out); });
+            }
+            st.meanDepth = st.frames ? (double)depthSum / st.frames : 0.0;
+            endOfStream(k + 1);
+        });
+    }
+
+    // sink on the calling thread
+    long long frames = 0;
+    for (;;) {
+        Frame f;
+        waitFor([&]() { return fwd[n]->pop(f); });
+        if (f.index < 0) break;
+        sink(f.image);
+        back[n]->push(f.image);
+        frames++;
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+    m_wallMs = elapsedMs(start);
+    return frames;
+}
+
+void HW_Pipeline::report(FILE* fp) const {
+    fprintf(fp, "%-16s %8s %9s %9s %7s %10s %10s %6s %4s\n",
+            "stage", "frames", "mean ms", "max ms", "busy", "starved ms", "blocked ms", "depth", "max");
+
+    int slowest = -1;
+    for (size_t k = 0; k < m_stats.size(); ++k) {
+        const HW_StageStats& st = m_stats[k];
+        const double mean = st.frames ? st.busyMs / st.frames : 0.0;
+        const double busy = (m_wallMs > 0.0) ? 100.0 * st.busyMs / m_wallMs : 0.0;
+        fprintf(fp, "%-16s %8lld %9.2f %9.2f %6.1f%% %10.1f %10.1f %6.2f %4d\n",
+                st.name.c_str(), st.frames, mean, st.maxMs, busy, st.starvedMs, st.blockedMs,
+                st.meanDepth, st.maxDepth);
+        if (slowest < 0 || st.busyMs > m_stats[slowest].busyMs) slowest = (int)k;
+    }
+
+    const long long frames = m_stats.empty() ? 0 : m_stats.back().frames;
+    if (frames > 0 && m_wallMs > 0.0) {
+        fprintf(fp, "%lld frames in %.1f ms: %.2f frames/s", frames, m_wallMs, 1000.0 * frames / m_wallMs);
+        if (slowest >= 0)
+            fprintf(fp, " (slowest stage %s: %.2f frames/s)", m_stats[slowest].name.c_str(),
+                    1000.0 * m_stats[slowest].frames / m_stats[slowest].busyMs);
+        fprintf(fp, "\n");
+    }
+}
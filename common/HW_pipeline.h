@@ -0,0 +1,131 @@
+#ifndef HW_PIPELINE_H
+#define HW_PIPELINE_H
+
+#include "IP.h"
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_SpscQueue:
+//
+// Bounded lock-free single-producer/single-consumer ring. push() fails
+// when capacity items are queued, pop() fails when the queue is empty;
+// the caller decides whether to spin, yield or do other work.
+//
+template <class T>
+class HW_SpscQueue {
+public:
+    explicit HW_SpscQueue(int capacity) : m_cap(capacity < 1 ? 1 : capacity), m_head(0), m_tail(0) {
+        size_t n = 1;
+        while (n < m_cap) n <<= 1;
+        m_buf.resize(n);
+        m_mask = n - 1;
+    }
+
+    bool push(const T& v) {
+        const size_t t = m_tail.load(std::memory_order_relaxed);
+        if (t - m_head.load(std::memory_order_acquire) >= m_cap) return false;
+        m_buf[t & m_mask] = v;
+        m_tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& v) {
+        const size_t h = m_head.load(std::memory_order_relaxed);
+        if (h == m_tail.load(std::memory_order_acquire)) return false;
+        v = std::move(m_buf[h & m_mask]);
+        m_head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // number of queued items (exact for producer or consumer, approximate otherwise)
+    int size() const {
+        return (int)(m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire));
+    }
+    int capacity() const { return (int)m_cap; }
+
+private:
+    std::vector<T> m_buf;
+    size_t m_cap, m_mask;
+    // head and tail on separate cache lines; padding rather than alignas(64),
+    // which plain new does not honor before C++17
+    char m_pad0[64];
+    std::atomic<size_t> m_head;                 // next item to pop (consumer)
+    char m_pad1[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_tail;                 // next free slot (producer)
+    char m_pad2[64 - sizeof(std::atomic<size_t>)];
+};
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_Pipeline:
+//
+// Multi-stage frame pipeline for video jobs such as
+//   HW_histoMatch -> HW_blur -> HW_sharpen -> HW_errDiffusion
+// Each stage runs one HW_* operator on its own worker thread, so stages
+// work on different frames at the same time and the throughput is set by
+// the slowest stage instead of the sum of all stages.
+//
+// Stages are connected by bounded HW_SpscQueues of queueDepth frames. A
+// full queue blocks its producer (backpressure), so at most queueDepth
+// frames wait between two stages. Output images are recycled: once a stage
+// has consumed a frame, the image goes back to the stage that produced it
+// and is reused as the output of a later frame, so a run allocates at most
+// queueDepth + 2 images per stage.
+//
+// run() calls source on a feeder thread until it returns false; source may
+// fill the recycled image it is given in place or replace it. sink is
+// called on the calling thread with every output frame, in input order.
+// Sink images are recycled too: once sink returns, the image goes back to
+// the last stage and is overwritten by a later frame, so a sink that keeps
+// frames must copy them.
+//
+//   HW_Pipeline p(4);
+//   p.addStage("blur", [](ImagePtr I, ImagePtr O) { HW_blur(I, 5, 5, O); });
+//   p.addStage("sharpen", [](ImagePtr I, ImagePtr O) { HW_sharpen(I, 5, 2.0, O); });
+//   p.run(readFrame, writeFrame);
+//   p.report(stdout);
+//
+struct HW_StageStats {
+    std::string name;
+    long long frames;
+    double busyMs;          // time spent in the operator
+    double maxMs;           // slowest frame
+    double starvedMs;       // waiting for input
+    double blockedMs;       // waiting for a free output image or queue slot
+    double meanDepth;       // input queue depth seen at each pop
+    int    maxDepth;
+};
+
+class HW_Pipeline {
+public:
+    typedef std::function<void(ImagePtr, ImagePtr)> Op;
+
+    explicit HW_Pipeline(int queueDepth = 4);
+
+    void addStage(const char* name, Op op);
+
+    // returns the number of frames processed
+    long long run(const std::function<bool(ImagePtr&)>& source, const std::function<void(ImagePtr)>& sink);
+
+    // statistics of the last run
+    const std::vector<HW_StageStats>& stats() const { return m_stats; }
+    double wallMs() const { return m_wallMs; }
+    void   report(FILE* fp) const;
+
+private:
+    struct Stage {
+        std::string name;
+        Op op;
+    };
+
+    int m_depth;
+    std::vector<Stage> m_stages;
+    std::vector<HW_StageStats> m_stats;
+    double m_wallMs;
+};
+
+#endif
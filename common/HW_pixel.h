@@ -0,0 +1,108 @@
+#ifndef HW_PIXEL_H
+#define HW_PIXEL_H
+
+#include "IP.h"
+#include <cmath>
+#include <vector>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Pixel-type specialization for the HW_* operators.
+//
+// Every operator is written once as a template on the channel type T and
+// dispatched at runtime on the type returned by IP_getChannel():
+//   UCHAR_TYPE -> uchar           8-bit, range [0,255]
+//   SHORT_TYPE -> unsigned short  12/16-bit sensor data, range [0,65535]
+//   FLOAT_TYPE -> float           unquantized, same [0,255] scale as uchar
+//
+// Intensity parameters (thresholds, brightness, ...) stay in 8-bit units
+// for every type and are scaled by HW_pixelScale<T>() to the native range.
+// Integer types tabulate point operations in a LUT over all values
+// (256 or 65536 entries); float evaluates the mapping per pixel.
+//
+
+template <class T> struct HW_PixelTraits;
+
+template <> struct HW_PixelTraits<IP::uchar> {
+    typedef int       Accum;        // sums of up to ~8M pixels
+    typedef long long Wide;         // sums of squares
+    enum { isInteger = 1, lutSize = IP::MXGRAY };
+    static double maxVal() { return IP::MaxGray; }
+};
+
+template <> struct HW_PixelTraits<unsigned short> {
+    typedef long long Accum;
+    typedef long long Wide;
+    enum { isInteger = 1, lutSize = 65536 };
+    static double maxVal() { return 65535.0; }
+};
+
+template <> struct HW_PixelTraits<float> {
+    typedef double Accum;
+    typedef double Wide;
+    enum { isInteger = 0, lutSize = 0 };
+    static double maxVal() { return IP::MaxGray; }
+};
+
+// native units per 8-bit unit (1 for uchar and float, 257 for ushort)
+template <class T> inline double HW_pixelScale() {
+    return HW_PixelTraits<T>::maxVal() / IP::MaxGray;
+}
+
+// number of distinct levels (256, 65536; 256 for float)
+template <class T> inline double HW_pixelRange() {
+    return HW_PixelTraits<T>::isInteger ? HW_PixelTraits<T>::maxVal() + 1.0 : (double)IP::MXGRAY;
+}
+
+// round to the precision of T: nearest integer for integer types, unchanged for float
+template <class T> inline double HW_round(double v) {
+    return HW_PixelTraits<T>::isInteger ? std::floor(v + 0.5) : v;
+}
+
+// clamp to [0, maxVal] and convert (truncates for integer types)
+template <class T> inline T HW_clampPixel(double v) {
+    if (v < 0.0) return 0;
+    if (v > HW_PixelTraits<T>::maxVal()) return (T)HW_PixelTraits<T>::maxVal();
+    return (T)v;
+}
+
+// channel type of image I (UCHAR_TYPE, SHORT_TYPE or FLOAT_TYPE)
+inline int HW_pixelType(ImagePtr I) {
+    IP::ChannelPtr<IP::uchar> p;
+    int type = IP::UCHAR_TYPE;
+    if (!IP::IP_getChannel(I, 0, p, type)) return IP::UCHAR_TYPE;
+    return type;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_applyPointOp:
+//
+// Evaluate I2 = map(I1) on every channel; map takes and returns values in
+// T's native units, and its result is clamped with HW_clampPixel<T>().
+// I2 must already have I1's header.
+//
+template <class T, class Map>
+void HW_applyPointOp(ImagePtr I1, ImagePtr I2, Map map) {
+    const int total = I1->width() * I1->height();
+    IP::ChannelPtr<T> p1, p2;
+    int type;
+
+    if (HW_PixelTraits<T>::isInteger) {
+        // tabulate once over all possible values
+        std::vector<T> lut(HW_PixelTraits<T>::lutSize);
+        for (int i = 0; i < (int)lut.size(); ++i) lut[i] = HW_clampPixel<T>(map((double)i));
+
+        for (int ch = 0; IP::IP_getChannel(I1, ch, p1, type); ch++) {
+            IP::IP_getChannel(I2, ch, p2, type);
+            for (int i = 0; i < total; i++) *p2++ = lut[(int)*p1++];
+        }
+        return;
+    }
+
+    // direct math
+    for (int ch = 0; IP::IP_getChannel(I1, ch, p1, type); ch++) {
+        IP::IP_getChannel(I2, ch, p2, type);
+        for (int i = 0; i < total; i++) *p2++ = HW_clampPixel<T>(map((double)*p1++));
+    }
+}
+
+#endif
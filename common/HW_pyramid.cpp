@@ -0,0 +1,224 @@
+#include "IP.h"
+#include "HW_pyramid.h"
+#include "HW_instrument.h"
+#include "HW_parallel.h"
+#include "HW_pixel.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace IP;
+
+static inline int clampIndex(int v, int n) {
+    return (v < 0) ? 0 : (v >= n ? n - 1 : v);
+}
+
+static ImagePtr allocLike(ImagePtr I, int w, int h) {
+    return IP_allocImage(w, h, (I->maxDepth() == 1) ? BW_IMAGE : RGB_IMAGE);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// fused blur + decimate
+//
+
+// vertical [1 4 6 4 1] of five rows into v[0..w)
+static void binomialRows(const uchar* const r[5], int w, unsigned short* v) {
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= w; x += 16) {
+        __m128i in[5];
+        for (int k = 0; k < 5; ++k) in[k] = _mm_loadu_si128((const __m128i*)(r[k] + x));
+        for (int half = 0; half < 2; ++half) {
+            __m128i p[5];
+            for (int k = 0; k < 5; ++k)
+                p[k] = half ? _mm_unpackhi_epi8(in[k], zero) : _mm_unpacklo_epi8(in[k], zero);
+            // a + e + 4(b + d) + 4c + 2c
+            __m128i s = _mm_add_epi16(p[0], p[4]);
+            s = _mm_add_epi16(s, _mm_slli_epi16(_mm_add_epi16(_mm_add_epi16(p[1], p[3]), p[2]), 2));
+            s = _mm_add_epi16(s, _mm_slli_epi16(p[2], 1));
+            _mm_storeu_si128((__m128i*)(v + x + 8 * half), s);
+        }
+    }
+#endif
+    for (; x < w; ++x) v[x] = r[0][x] + r[4][x] + 4 * (r[1][x] + r[3][x]) + 6 * r[2][x];
+}
+
+// level i+1 of one channel: src is w x h, dst is (w+1)/2 x (h+1)/2
+static void reduceChannel(const uchar* src, int w, int h, uchar* dst) {
+    const int w2 = (w + 1) / 2, h2 = (h + 1) / 2;
+
+    HW_parallelFor(0, h2, 16, [&](int y0, int y1) {
+        std::vector<unsigned short> line(w + 4);
+        unsigned short* v = &line[2];
+        for (int Y = y0; Y < y1; ++Y) {
+            const uchar* r[5];
+            for (int k = 0; k < 5; ++k) r[k] = src + (long long)clampIndex(2 * Y + k - 2, h) * w;
+            binomialRows(r, w, v);
+            v[-2] = v[-1] = v[0];
+            v[w] = v[w + 1] = v[w - 1];
+
+            // horizontal [1 4 6 4 1] at the even columns only; weights sum to 256
+            uchar* out = dst + (long long)Y * w2;
+            for (int X = 0; X < w2; ++X) {
+                const unsigned short* c = v + 2 * X;
+                int s = c[-2] + c[2] + 4 * (c[-1] + c[1]) + 6 * c[0];
+                out[X] = (uchar)((s + 128) >> 8);
+            }
+        }
+    });
+}
+
+// upsample one channel from w2 x h2 to w x h: even samples (1 6 1)/8, odd (4 4)/8 per direction
+static void expandChannel(const uchar* src, int w2, int h2, uchar* dst, int w, int h) {
+    HW_parallelFor(0, h, 32, [&](int y0, int y1) {
+        std::vector<int> line(w2 + 2);
+        int* v = &line[1];
+        for (int y = y0; y < y1; ++y) {
+            const int k = y / 2;
+            const uchar* b = src + (long long)k * w2;
+            const uchar* c = src + (long long)clampIndex(k + 1, h2) * w2;
+            if (y & 1) {
+                for (int X = 0; X < w2; ++X) v[X] = 4 * (b[X] + c[X]);
+            }
+            else {
+                const uchar* a = src + (long long)clampIndex(k - 1, h2) * w2;
+                for (int X = 0; X < w2; ++X) v[X] = a[X] + 6 * b[X] + c[X];
+            }
+            v[-1] = v[0];
+            v[w2] = v[w2 - 1];
+
+            // weights sum to 64
+            uchar* out = dst + (long long)y * w;
+            for (int x = 0; x < w; ++x) {
+                const int X = x / 2;
+                int s = (x & 1) ? 4 * (v[X] + v[X + 1]) : v[X - 1] + 6 * v[X] + v[X + 1];
+                out[x] = (uchar)((s + 32) >> 6);
+            }
+        }
+    });
+}
+
+static void expandImage(ImagePtr I, int w, int h, ImagePtr O) {
+    const int w2 = I->width(), h2 = I->height();
+    IP_copyImageHeader(allocLike(I, w, h), O);
+    ChannelPtr<uchar> p1, p2;
+    int type;
+    for (int ch = 0; IP_getChannel(I, ch, p1, type); ch++) {
+        IP_getChannel(O, ch, p2, type);
+        expandChannel(p1, w2, h2, p2, w, h);
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_Pyramid
+//
+
+int HW_pyramidScale(int size, int level) {
+    int s = (level > 0) ? (size >> level) : size;
+    if (s < 1) s = 1;
+    if ((s & 1) == 0) s++;
+    return s;
+}
+
+HW_Pyramid::HW_Pyramid() {}
+
+void HW_Pyramid::build(ImagePtr I, int levels, bool laplacian) {
+    m_levels.assign(1, I);
+    m_bands.clear();
+
+    // the fused kernels are 8-bit; other pixel types keep level 0 only
+    if (HW_pixelType(I) != UCHAR_TYPE) return;
+
+    // pixels read by the reductions, from the level sizes
+    long long pixels = 0;
+    for (int i = 1, w = I->width(), h = I->height(); i < levels && (w > 1 || h > 1); ++i) {
+        pixels += (long long)w * h * I->maxDepth();
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+
+    // time the Gaussian levels
+    {
+        HW_PROFILE("HW_pyramid", pixels, pixels + pixels / 4);
+
+        for (int i = 1; i < levels; ++i) {
+            ImagePtr G = m_levels.back();
+            const int w = G->width(), h = G->height();
+            if (w == 1 && h == 1) break;
+
+            ImagePtr R = allocLike(G, (w + 1) / 2, (h + 1) / 2);
+            ChannelPtr<uchar> p1, p2;
+            int type;
+            for (int ch = 0; IP_getChannel(G, ch, p1, type); ch++) {
+                IP_getChannel(R, ch, p2, type);
+                reduceChannel(p1, w, h, p2);
+            }
+            m_levels.push_back(R);
+        }
+    }
+
+    if (!laplacian) return;
+
+    // L(i) = G(i) - expand(G(i+1))
+    m_bands.resize(m_levels.size() - 1);
+    for (size_t i = 0; i + 1 < m_levels.size(); ++i) {
+        ImagePtr G = m_levels[i], E;
+        const int total = G->width() * G->height();
+        expand((int)i, E);
+
+        std::vector<float>& band = m_bands[i];
+        band.resize((size_t)total * G->maxDepth());
+        ChannelPtr<uchar> pg, pe;
+        int type;
+        for (int ch = 0; IP_getChannel(G, ch, pg, type); ch++) {
+            IP_getChannel(E, ch, pe, type);
+            float* d = &band[(size_t)ch * total];
+            for (int k = 0; k < total; ++k) d[k] = (float)pg[k] - (float)pe[k];
+        }
+    }
+}
+
+int HW_Pyramid::levelFor(int viewW, int viewH) const {
+    for (int i = levels() - 1; i > 0; --i)
+        if (m_levels[i]->width() >= viewW && m_levels[i]->height() >= viewH) return i;
+    return 0;
+}
+
+void HW_Pyramid::run(const LevelOp& op, int level, ImagePtr O) const {
+    if (level < 0) level = 0;
+    if (level >= levels()) level = levels() - 1;
+    op(m_levels[level], level, O);
+}
+
+void HW_Pyramid::expand(int i, ImagePtr O) const {
+    expandImage(m_levels[i + 1], m_levels[i]->width(), m_levels[i]->height(), O);
+}
+
+void HW_Pyramid::reconstruct(ImagePtr O) const {
+    ImagePtr cur = m_levels.back();
+    for (int i = levels() - 2; i >= 0; --i) {
+        const int w = m_levels[i]->width(), h = m_levels[i]->height();
+        ImagePtr E;
+        expandImage(cur, w, h, E);
+        cur = E;
+        if (m_bands.empty()) continue;
+
+        // add the band back: exact, since the band was taken against the same expansion
+        const int total = w * h;
+        ChannelPtr<uchar> p;
+        int type;
+        for (int ch = 0; IP_getChannel(E, ch, p, type); ch++) {
+            const float* d = &m_bands[i][(size_t)ch * total];
+            for (int k = 0; k < total; ++k) p[k] = HW_clampPixel<uchar>(p[k] + d[k] + 0.5);
+        }
+    }
+
+    IP_copyImageHeader(cur, O);
+    const int total = cur->width() * cur->height();
+    ChannelPtr<uchar> p1, p2;
+    int type;
+    for (int ch = 0; IP_getChannel(cur, ch, p1, type); ch++) {
+        IP_getChannel(O, ch, p2, type);
+        for (int k = 0; k < total; ++k) p2[k] = p1[k];
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef HW_PYRAMID_H
+#define HW_PYRAMID_H
+
+#include "IP.h"
+#include <functional>
+#include <vector>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_Pyramid:
+//
+// Gaussian (and optionally Laplacian) image pyramid for multi-scale
+// processing and fast previews.
+//
+// Level 0 is the input; level i+1 is level i filtered with the separable
+// 5-tap binomial kernel [1 4 6 4 1]/16 and decimated by 2 in each
+// direction ((w+1)/2 x (h+1)/2). Blur and decimation are fused: only the
+// kept samples are filtered, each output row combines five input rows
+// into one line (SSE2 for 8-bit images) and is filtered horizontally
+// at the even columns, so no full-resolution intermediate is written.
+// Output rows are built in parallel. Borders are replicated.
+//
+// With laplacian = true, build() also keeps the band-pass levels
+// L(i) = G(i) - expand(G(i+1)), and reconstruct() rebuilds level 0
+// exactly from the coarsest Gaussian level and the bands.
+//
+// Previews run an operator on a reduced level and escalate to level 0 on
+// commit with the same call; the operator receives the level so that it
+// can scale its window sizes (HW_pyramidScale):
+//
+//   HW_Pyramid pyr;
+//   pyr.build(I, 5);
+//   int lvl = pyr.levelFor(viewW, viewH);
+//   auto op = [](ImagePtr I, int level, ImagePtr O) {
+//       int sz = HW_pyramidScale(15, level);
+//       HW_blur(I, sz, sz, O);
+//   };
+//   pyr.run(op, lvl, preview);     // interactive
+//   pyr.run(op, 0, result);        // commit
+//
+
+// window size for level: size / 2^level, kept odd and >= 1
+int HW_pyramidScale(int size, int level);
+
+class HW_Pyramid {
+public:
+    typedef std::function<void(ImagePtr, int, ImagePtr)> LevelOp;
+
+    HW_Pyramid();
+
+    // build levels 0..levels-1 of I (fewer if the image gets down to 1x1)
+    void build(ImagePtr I, int levels, bool laplacian = false);
+
+    int levels() const { return (int)m_levels.size(); }
+    ImagePtr level(int i) const { return m_levels[i]; }
+
+    // coarsest level that still covers a viewW x viewH viewport
+    int levelFor(int viewW, int viewH) const;
+
+    // run op on level i; output is in O
+    void run(const LevelOp& op, int level, ImagePtr O) const;
+
+    // upsample level i+1 to the size of level i (binomial interpolation)
+    void expand(int i, ImagePtr O) const;
+
+    // rebuild level 0 from the coarsest level and the Laplacian bands
+    // (without bands: the coarsest level upsampled to full size)
+    void reconstruct(ImagePtr O) const;
+
+private:
+    std::vector<ImagePtr> m_levels;
+    // Laplacian band of level i, all channels, as exact differences
+    std::vector<std::vector<float>> m_bands;
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include "IP.h"
+#include "HW_roi.h"
+#include "HW_pixel.h"
+#include <algorithm>
+#include <cstdio>
+using namespace IP;
+
+void HW_adaptiveThreshold(ImagePtr, int, int, double, ImagePtr);
+int  HW_thresholdOtsu(ImagePtr, ImagePtr);
+void HW_thresholdMultiOtsu(ImagePtr, int, ImagePtr);
+void HW_histoStretchAuto(ImagePtr, double, double, ImagePtr);
+void HW_quantizeAdaptive(ImagePtr, int, ImagePtr);
+void HW_erode(ImagePtr, int, int, ImagePtr);
+void HW_dilate(ImagePtr, int, int, ImagePtr);
+void HW_open(ImagePtr, int, int, ImagePtr);
+void HW_close(ImagePtr, int, int, ImagePtr);
+void HW_tophat(ImagePtr, int, int, ImagePtr);
+
+// context an error-diffusion ROI is warmed up over, on each side
+static const int kDiffusionMargin = 32;
+
+// w x h image with the channels and pixel type of I: 8-bit BW or RGB, or
+// one float channel; a null image for layouts IP_allocImage cannot make
+static ImagePtr allocLike(ImagePtr I, int w, int h) {
+    switch (HW_pixelType(I)) {
+    case UCHAR_TYPE: return IP_allocImage(w, h, (I->maxDepth() == 1) ? BW_IMAGE : RGB_IMAGE);
+    case FLOAT_TYPE: if (I->maxDepth() == 1) return IP_allocImage(w, h, FLOATCH_TYPE); break;
+    }
+    return ImagePtr();
+}
+
+// half of a window size, as the operators round it up to odd
+static int halfWindow(int size) {
+    return ((size < 1) ? 1 : (size | 1)) / 2;
+}
+
+// copy the w x h rectangle at (sx, sy) of every channel of S to (dx, dy) of D
+template <class T>
+static void copyRect(ImagePtr S, int sx, int sy, int w, int h, ImagePtr D, int dx, int dy) {
+    const int sw = S->width(), dw = D->width();
+    ChannelPtr<T> ps, pd;
+    int type;
+    for (int ch = 0; IP_getChannel(S, ch, ps, type); ch++) {
+        IP_getChannel(D, ch, pd, type);
+        for (int y = 0; y < h; ++y) {
+            const T* s = &ps[(long long)(sy + y) * sw + sx];
+            std::copy(s, s + w, &pd[(long long)(dy + y) * dw + dx]);
+        }
+    }
+}
+
+static void copyRect(ImagePtr S, int sx, int sy, int w, int h, ImagePtr D, int dx, int dy) {
+    switch (HW_pixelType(S)) {
+    case SHORT_TYPE: copyRect<unsigned short>(S, sx, sy, w, h, D, dx, dy); break;
+    case FLOAT_TYPE: copyRect<float>(S, sx, sy, w, h, D, dx, dy); break;
+    default:         copyRect<uchar>(S, sx, sy, w, h, D, dx, dy); break;
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_roiApply:
+//
+// Crop the ROI of I1 with haloX x haloY pixels of context (clipped to the
+// image), run op on the crop and keep the ROI of the result. An empty
+// ROI leaves I2 unchanged. Images whose layout cannot be allocated at
+// the crop size are rejected with a message, leaving I2 unchanged.
+//
+bool HW_roiApply(ImagePtr I1, const HW_Roi& roi, int haloX, int haloY,
+                 const std::function<void(ImagePtr, ImagePtr)>& op, ImagePtr I2) {
+    const int W = I1->width(), H = I1->height();
+    const int x0 = std::max(roi.x, 0), x1 = std::min(roi.x + roi.w, W);
+    const int y0 = std::max(roi.y, 0), y1 = std::min(roi.y + roi.h, H);
+    if (x1 <= x0 || y1 <= y0) return true;
+
+    const int wx0 = std::max(x0 - haloX, 0), wx1 = std::min(x1 + haloX, W);
+    const int wy0 = std::max(y0 - haloY, 0), wy1 = std::min(y1 + haloY, H);
+    ImagePtr window = allocLike(I1, wx1 - wx0, wy1 - wy0);
+    if (window.isNull()) {
+        fprintf(stderr, "HW_roiApply: no ROI support for %d-channel %s images\n", I1->maxDepth(),
+                HW_pixelType(I1) == SHORT_TYPE ? "16-bit" : "float");
+        return false;
+    }
+    copyRect(I1, wx0, wy0, wx1 - wx0, wy1 - wy0, window, 0, 0);
+
+    ImagePtr out;
+    op(window, out);
+    const int ox = x0 - wx0, oy = y0 - wy0;     // ROI origin in out
+
+    if (!roi.inPlace) {
+        IP_copyImageHeader(allocLike(out, x1 - x0, y1 - y0), I2);
+        copyRect(out, ox, oy, x1 - x0, y1 - y0, I2, 0, 0);
+        return true;
+    }
+    if (I2->width() != W || I2->height() != H) {
+        IP_copyImageHeader(I1, I2);
+        copyRect(I1, 0, 0, W, H, I2, 0, 0);
+    }
+    copyRect(out, ox, oy, x1 - x0, y1 - y0, I2, x0, y0);
+    return true;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// point operators
+//
+
+void HW_threshold(ImagePtr I1, int thr, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_threshold(I, thr, O); }, I2);
+}
+
+int HW_thresholdOtsu(ImagePtr I1, ImagePtr I2, const HW_Roi& roi) {
+    int thr = 0;
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { thr = HW_thresholdOtsu(I, O); }, I2);
+    return thr;
+}
+
+void HW_thresholdMultiOtsu(ImagePtr I1, int levels, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_thresholdMultiOtsu(I, levels, O); }, I2);
+}
+
+void HW_clip(ImagePtr I1, int t1, int t2, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_clip(I, t1, t2, O); }, I2);
+}
+
+void HW_quantize(ImagePtr I1, int levels, bool dither, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_quantize(I, levels, dither, O); }, I2);
+}
+
+void HW_quantizeAdaptive(ImagePtr I1, int levels, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_quantizeAdaptive(I, levels, O); }, I2);
+}
+
+void HW_gammaCorrect(ImagePtr I1, double gamma, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_gammaCorrect(I, gamma, O); }, I2);
+}
+
+void HW_contrast(ImagePtr I1, double brightness, double contrast, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_contrast(I, brightness, contrast, O); }, I2);
+}
+
+void HW_histoStretch(ImagePtr I1, int t1, int t2, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_histoStretch(I, t1, t2, O); }, I2);
+}
+
+void HW_histoStretchAuto(ImagePtr I1, double loPct, double hiPct, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_histoStretchAuto(I, loPct, hiPct, O); }, I2);
+}
+
+void HW_histoMatch(ImagePtr I1, ImagePtr targetHisto, bool approxAlg, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 0, 0, [&](ImagePtr I, ImagePtr O) { HW_histoMatch(I, targetHisto, approxAlg, O); }, I2);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// neighborhood operators
+//
+
+void HW_adaptiveThreshold(ImagePtr I1, int method, int size, double k, ImagePtr I2, const HW_Roi& roi) {
+    const int r = halfWindow(size);
+    HW_roiApply(I1, roi, r, r, [&](ImagePtr I, ImagePtr O) { HW_adaptiveThreshold(I, method, size, k, O); }, I2);
+}
+
+void HW_blur(ImagePtr I1, int filterW, int filterH, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, halfWindow(filterW), halfWindow(filterH),
+                [&](ImagePtr I, ImagePtr O) { HW_blur(I, filterW, filterH, O); }, I2);
+}
+
+void HW_sharpen(ImagePtr I1, int size, double factor, ImagePtr I2, const HW_Roi& roi) {
+    const int r = halfWindow(size);
+    HW_roiApply(I1, roi, r, r, [&](ImagePtr I, ImagePtr O) { HW_sharpen(I, size, factor, O); }, I2);
+}
+
+void HW_median(ImagePtr I1, int sz, ImagePtr I2, const HW_Roi& roi) {
+    const int r = halfWindow(sz);
+    HW_roiApply(I1, roi, r, r, [&](ImagePtr I, ImagePtr O) { HW_median(I, sz, O); }, I2);
+}
+
+void HW_convolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, Ikernel->width() / 2, Ikernel->height() / 2,
+                [&](ImagePtr I, ImagePtr O) { HW_convolve(I, Ikernel, O); }, I2);
+}
+
+void HW_errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, kDiffusionMargin, kDiffusionMargin,
+                [&](ImagePtr I, ImagePtr O) { HW_errDiffusion(I, method, serpentine, gamma, O); }, I2);
+}
+
+void HW_erode(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, halfWindow(sizeW), halfWindow(sizeH),
+                [&](ImagePtr I, ImagePtr O) { HW_erode(I, sizeW, sizeH, O); }, I2);
+}
+
+void HW_dilate(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, halfWindow(sizeW), halfWindow(sizeH),
+                [&](ImagePtr I, ImagePtr O) { HW_dilate(I, sizeW, sizeH, O); }, I2);
+}
+
+void HW_open(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 2 * halfWindow(sizeW), 2 * halfWindow(sizeH),
+                [&](ImagePtr I, ImagePtr O) { HW_open(I, sizeW, sizeH, O); }, I2);
+}
+
+void HW_close(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 2 * halfWindow(sizeW), 2 * halfWindow(sizeH),
+                [&](ImagePtr I, ImagePtr O) { HW_close(I, sizeW, sizeH, O); }, I2);
+}
+
+void HW_tophat(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi) {
+    HW_roiApply(I1, roi, 2 * halfWindow(sizeW), 2 * halfWindow(sizeH),
+                [&](ImagePtr I, ImagePtr O) { HW_tophat(I, sizeW, sizeH, O); }, I2);
+}
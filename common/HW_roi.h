@@ -0,0 +1,86 @@
+#ifndef HW_ROI_H
+#define HW_ROI_H
+
+#include "IP.h"
+#include <functional>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Region-of-interest execution for the HW_* operators.
+//
+// Every operator has an overload taking an HW_Roi as its last argument.
+// Only the pixels of the ROI plus the halo the operator needs around it
+// are read, and only the ROI is computed, so the cost is proportional to
+// the ROI area rather than the image area:
+//   point operators                 no halo
+//   blur, sharpen, median,
+//   convolve, adaptiveThreshold     half the window on each side
+//   erode, dilate                   half the window
+//   open, close, tophat             twice half the window (two passes)
+//   errDiffusion                    a 32-pixel warm-up margin
+//
+// Inside the image the halo holds real pixels, and at the image border the
+// operators replicate as usual, so neighborhood results equal the same
+// pixels of the full-frame result. Two exceptions: error diffusion carries
+// its error state in from the warm-up margin only, so its dither pattern
+// differs from the full-frame pattern; and operators driven by image
+// statistics (histoStretchAuto, histoMatch, quantizeAdaptive,
+// thresholdOtsu, thresholdMultiOtsu) use the statistics of the ROI.
+//
+// Output is either an ROI-sized image (inPlace = false) or written into
+// the ROI of a full-size I2 (inPlace = true), leaving the rest of I2
+// untouched. If I2 is not the size of I1, it is first made a copy of I1.
+// The ROI is clipped to the image. 8-bit and single-channel float images
+// are cropped; other layouts (16-bit, multi-channel float) cannot be
+// allocated at the crop size, so they are rejected: HW_roiApply returns
+// false and leaves I2 unchanged.
+//
+//   // inspect 50 regions of a large frame
+//   for (const HW_Roi& r : regions) {
+//       ImagePtr O;
+//       HW_median(I, 5, O, r);
+//       ...
+//   }
+//
+
+struct HW_Roi {
+    int x, y;
+    int w, h;
+    bool inPlace;
+};
+
+inline HW_Roi HW_roi(int x, int y, int w, int h, bool inPlace = false) {
+    HW_Roi r = { x, y, w, h, inPlace };
+    return r;
+}
+
+// run op(in, out) on the ROI of I1 with haloX x haloY pixels of context
+bool HW_roiApply(ImagePtr I1, const HW_Roi& roi, int haloX, int haloY,
+                 const std::function<void(ImagePtr, ImagePtr)>& op, ImagePtr I2);
+
+// point operators
+void HW_threshold(ImagePtr I1, int thr, ImagePtr I2, const HW_Roi& roi);
+int  HW_thresholdOtsu(ImagePtr I1, ImagePtr I2, const HW_Roi& roi);
+void HW_thresholdMultiOtsu(ImagePtr I1, int levels, ImagePtr I2, const HW_Roi& roi);
+void HW_clip(ImagePtr I1, int t1, int t2, ImagePtr I2, const HW_Roi& roi);
+void HW_quantize(ImagePtr I1, int levels, bool dither, ImagePtr I2, const HW_Roi& roi);
+void HW_quantizeAdaptive(ImagePtr I1, int levels, ImagePtr I2, const HW_Roi& roi);
+void HW_gammaCorrect(ImagePtr I1, double gamma, ImagePtr I2, const HW_Roi& roi);
+void HW_contrast(ImagePtr I1, double brightness, double contrast, ImagePtr I2, const HW_Roi& roi);
+void HW_histoStretch(ImagePtr I1, int t1, int t2, ImagePtr I2, const HW_Roi& roi);
+void HW_histoStretchAuto(ImagePtr I1, double loPct, double hiPct, ImagePtr I2, const HW_Roi& roi);
+void HW_histoMatch(ImagePtr I1, ImagePtr targetHisto, bool approxAlg, ImagePtr I2, const HW_Roi& roi);
+
+// neighborhood operators
+void HW_adaptiveThreshold(ImagePtr I1, int method, int size, double k, ImagePtr I2, const HW_Roi& roi);
+void HW_blur(ImagePtr I1, int filterW, int filterH, ImagePtr I2, const HW_Roi& roi);
+void HW_sharpen(ImagePtr I1, int size, double factor, ImagePtr I2, const HW_Roi& roi);
+void HW_median(ImagePtr I1, int sz, ImagePtr I2, const HW_Roi& roi);
+void HW_convolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2, const HW_Roi& roi);
+void HW_errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, ImagePtr I2, const HW_Roi& roi);
+void HW_erode(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi);
+void HW_dilate(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi);
+void HW_open(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi);
+void HW_close(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi);
+void HW_tophat(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2, const HW_Roi& roi);
+
+#endif
@@ -0,0 +1,398 @@
+#include "IP.h"
+#include "HW_tune.h"
+#include "HW_graph.h"
+#include "HW_interleaved.h"
+#include "HW_parallel.h"
+#include "HW_pixel.h"
+#include "HW_roi.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace IP;
+
+void HW_blurIntegral(ImagePtr, int, int, ImagePtr);
+void HW_convolveFixed(ImagePtr, ImagePtr, ImagePtr);
+void HW_convolveSeparable(ImagePtr, ImagePtr, ImagePtr);
+bool HW_kernelFixedPoint(ImagePtr);
+bool HW_kernelSeparable(ImagePtr);
+void HW_errDiffusionWavefront(ImagePtr, int, bool, double, ImagePtr);
+
+// largest input crop a benchmark runs on
+static const int kBenchSize = 1024;
+
+namespace {
+
+// one way to run the call being tuned
+struct Candidate {
+    std::string name;
+    int tolerance;                                  // max difference from the reference
+    std::function<void(ImagePtr, ImagePtr)> fn;
+};
+
+struct Decision {
+    std::string variant;
+    int threads;                                    // 0 = no cap
+    double ms;
+};
+
+struct TuneState {
+    std::mutex lock;
+    std::map<std::string, Decision> table;          // by call key
+    std::map<std::string, Decision> overrides;      // by operator, "*" for all
+    std::string path;
+    int tolerance = 1;
+    bool initialized = false;
+};
+
+TuneState& state() {
+    static TuneState s;
+    return s;
+}
+
+int machineThreads() {
+    const int n = (int)std::thread::hardware_concurrency();
+    return (n > 0) ? n : 1;
+}
+
+// "op=variant[/threads],..." or "reference"
+void parseOverrides(const char* spec, std::map<std::string, Decision>& overrides) {
+    std::string s(spec);
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos) comma = s.size();
+        std::string item = s.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        const size_t eq = item.find('=');
+        std::string op = (eq == std::string::npos) ? "*" : item.substr(0, eq);
+        std::string variant = (eq == std::string::npos) ? item : item.substr(eq + 1);
+        int threads = 0;
+        const size_t slash = variant.find('/');
+        if (slash != std::string::npos) {
+            threads = std::atoi(variant.c_str() + slash + 1);
+            variant.resize(slash);
+        }
+        if (!variant.empty()) overrides[op] = Decision{ variant, threads, 0.0 };
+    }
+}
+
+void load(TuneState& st) {
+    st.table.clear();
+    FILE* fp = std::fopen(st.path.c_str(), "r");
+    if (!fp) return;
+
+    int threads = 0;
+    if (std::fscanf(fp, "# hw_tune threads %d", &threads) != 1 || threads != machineThreads()) {
+        std::fclose(fp);
+        return;
+    }
+    char key[256], variant[64];
+    Decision d;
+    while (std::fscanf(fp, "%255s %63s %d %lf", key, variant, &d.threads, &d.ms) == 4) {
+        d.variant = variant;
+        st.table[key] = d;
+    }
+    std::fclose(fp);
+}
+
+void save(const TuneState& st) {
+    FILE* fp = std::fopen(st.path.c_str(), "w");
+    if (!fp) return;
+    std::fprintf(fp, "# hw_tune threads %d\n", machineThreads());
+    for (const auto& e : st.table)
+        std::fprintf(fp, "%s %s %d %.3f\n", e.first.c_str(), e.second.variant.c_str(), e.second.threads, e.second.ms);
+    std::fclose(fp);
+}
+
+// read HW_TUNE, HW_TUNE_FILE and the table once; st.lock is held
+void initialize(TuneState& st) {
+    if (st.initialized) return;
+    st.initialized = true;
+    if (const char* env = std::getenv("HW_TUNE")) parseOverrides(env, st.overrides);
+    if (st.path.empty()) {
+        const char* file = std::getenv("HW_TUNE_FILE");
+        st.path = file ? file : "hw_tune.txt";
+    }
+    load(st);
+}
+
+// run c with at most threads threads, within any budget already in force
+void runWith(const Candidate& c, int threads, ImagePtr I1, ImagePtr I2) {
+    int& budget = HW_threadBudget();
+    const int saved = budget;
+    if (threads > 0 && (saved == 0 || threads < saved)) budget = threads;
+    c.fn(I1, I2);
+    budget = saved;
+}
+
+double timeMs(const Candidate& c, int threads, ImagePtr I1) {
+    ImagePtr out;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    runWith(c, threads, I1, out);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// fastest candidate and thread count on a crop of I1
+Decision benchmark(const std::vector<Candidate>& cands, int tolerance, ImagePtr I1) {
+    // other pixel types cannot be cropped and run on the full input
+    ImagePtr sample = I1;
+    if (HW_pixelType(I1) == UCHAR_TYPE && (I1->width() > kBenchSize || I1->height() > kBenchSize)) {
+        ImagePtr crop;
+        // clip to [0,255] is the identity
+        HW_roiApply(I1, HW_roi(0, 0, kBenchSize, kBenchSize), 0, 0,
+                    [](ImagePtr I, ImagePtr O) { HW_clip(I, 0, MaxGray, O); }, crop);
+        sample = crop;
+    }
+
+    const int n = HW_threadCount();
+    std::vector<int> threadCounts(1, 1);
+    if (n / 2 > 1) threadCounts.push_back(n / 2);
+    if (n > 1) threadCounts.push_back(n);
+
+    Decision best = { cands[0].name, 0, -1.0 };
+    for (const Candidate& c : cands) {
+        if (c.tolerance > tolerance) continue;
+        for (int t : threadCounts) {
+            double ms = timeMs(c, t, sample);
+            // a second run only for contenders (the first may include page faults)
+            if (best.ms < 0.0 || ms < 4.0 * best.ms) ms = std::min(ms, timeMs(c, t, sample));
+            if (best.ms < 0.0 || ms < best.ms) best = Decision{ c.name, t, ms };
+        }
+    }
+    return best;
+}
+
+const Candidate& find(const std::vector<Candidate>& cands, const std::string& name) {
+    for (const Candidate& c : cands)
+        if (c.name == name) return c;
+    return cands[0];
+}
+
+bool contains(const std::vector<Candidate>& cands, const std::string& name, int tolerance) {
+    for (const Candidate& c : cands)
+        if (c.name == name) return c.tolerance <= tolerance;
+    return false;
+}
+
+// run the call with the variant of its key: override, table entry or new benchmark
+void dispatch(const char* op, const std::string& key, const std::vector<Candidate>& cands,
+              ImagePtr I1, ImagePtr I2) {
+    TuneState& st = state();
+    Decision d;
+    int tolerance;
+    {
+        std::lock_guard<std::mutex> lk(st.lock);
+        initialize(st);
+        auto o = st.overrides.find(op);
+        if (o == st.overrides.end()) o = st.overrides.find("*");
+        tolerance = st.tolerance;
+        auto e = st.table.find(key);
+        if (o != st.overrides.end()) d = o->second;
+        else if (e != st.table.end() && contains(cands, e->second.variant, tolerance)) d = e->second;
+        else d.ms = -1.0;
+    }
+
+    if (d.ms < 0.0) {
+        d = benchmark(cands, tolerance, I1);
+        std::lock_guard<std::mutex> lk(st.lock);
+        st.table[key] = d;
+        save(st);
+    }
+    runWith(find(cands, d.variant), d.threads, I1, I2);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// call keys
+//
+
+// "<size class>/<pixel type>": size classes are powers of 4 from 64K pixels
+std::string imageClass(ImagePtr I) {
+    const long long pixels = (long long)I->width() * I->height();
+    long long lim = 1LL << 16;
+    while (pixels >= 4 * lim) lim *= 4;
+
+    char buf[32];
+    if (lim >= (1LL << 20)) std::snprintf(buf, sizeof(buf), "%lldM", lim >> 20);
+    else std::snprintf(buf, sizeof(buf), "%lldK", lim >> 10);
+
+    const int type = HW_pixelType(I);
+    return std::string(buf) + (type == SHORT_TYPE ? "/u16" : type == FLOAT_TYPE ? "/f32" : "/u8");
+}
+
+// window size class: 3, 7, 15, 31, ...
+int sizeClass(int n) {
+    int b = 3;
+    while (b < n) b = 2 * b + 1;
+    return b;
+}
+
+std::string format(const char* fmt, int a, int b = 0) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), fmt, a, b);
+    return buf;
+}
+
+} // namespace
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// tuned operators
+//
+
+void HW_tunedConvolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
+    const bool separable = HW_kernelSeparable(Ikernel);
+    std::vector<Candidate> cands;
+    cands.push_back({ "direct", 0, [&](ImagePtr I, ImagePtr O) { HW_convolve(I, Ikernel, O); } });
+    if (separable)
+        cands.push_back({ "separable", 1, [&](ImagePtr I, ImagePtr O) { HW_convolveSeparable(I, Ikernel, O); } });
+    if (HW_pixelType(I1) == UCHAR_TYPE && HW_kernelFixedPoint(Ikernel))
+        cands.push_back({ "fixed", 1, [&](ImagePtr I, ImagePtr O) { HW_convolveFixed(I, Ikernel, O); } });
+
+    const std::string key = "convolve/" + format("%dx%d", Ikernel->width(), Ikernel->height()) +
+                            (separable ? "s/" : "/") + imageClass(I1);
+    dispatch("convolve", key, cands, I1, I2);
+}
+
+void HW_tunedMedian(ImagePtr I1, int sz, ImagePtr I2) {
+    if (sz < 1) sz = 1;
+    if ((sz & 1) == 0) sz++;
+    if (sz > 9) sz = 9;
+
+    std::vector<Candidate> cands;
+    cands.push_back({ "sort", 0, [&](ImagePtr I, ImagePtr O) { HW_median(I, sz, O); } });
+    if (HW_pixelType(I1) == UCHAR_TYPE)
+        cands.push_back({ "histogram", 0, [&](ImagePtr I, ImagePtr O) {
+            const int w = I->width(), h = I->height();
+            IP_copyImageHeader(I, O);
+            ChannelPtr<uchar> src, dst;
+            int type;
+            for (int ch = 0; IP_getChannel(I, ch, src, type); ch++) {
+                IP_getChannel(O, ch, dst, type);
+                HW_interleavedMedian(HW_interleaved(src, w, h, 1), sz, HW_interleaved(dst, w, h, 1));
+            }
+        } });
+
+    dispatch("median", "median/" + format("sz%d", sz) + "/" + imageClass(I1), cands, I1, I2);
+}
+
+void HW_tunedBlur(ImagePtr I1, int filterW, int filterH, ImagePtr I2) {
+    std::vector<Candidate> cands;
+    cands.push_back({ "direct", 0, [&](ImagePtr I, ImagePtr O) { HW_blur(I, filterW, filterH, O); } });
+    if (HW_pixelType(I1) == UCHAR_TYPE) {
+        cands.push_back({ "integral", 1, [&](ImagePtr I, ImagePtr O) { HW_blurIntegral(I, filterW, filterH, O); } });
+        for (int tile : { 8, 32, 128 })
+            cands.push_back({ format("fused%d", tile), 0, [=](ImagePtr I, ImagePtr O) {
+                HW_Graph().setTileRows(tile).blur(filterW, filterH).run(I, O);
+            } });
+    }
+
+    const std::string key = "blur/" + format("w%dh%d", sizeClass(filterW), sizeClass(filterH)) + "/" + imageClass(I1);
+    dispatch("blur", key, cands, I1, I2);
+}
+
+void HW_tunedErrDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, ImagePtr I2) {
+    std::vector<Candidate> cands;
+    cands.push_back({ "serial", 0, [&](ImagePtr I, ImagePtr O) { HW_errDiffusion(I, method, serpentine, gamma, O); } });
+    if (!serpentine)
+        cands.push_back({ "wavefront", 0, [&](ImagePtr I, ImagePtr O) {
+            HW_errDiffusionWavefront(I, method, serpentine, gamma, O);
+        } });
+
+    const std::string key = "errDiffusion/" + format("m%d", method == 1 ? 1 : 0) +
+                            (serpentine ? "s/" : "r/") + imageClass(I1);
+    dispatch("errDiffusion", key, cands, I1, I2);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// calibration, settings and report
+//
+
+int HW_tuneCalibrate(ImagePtr sample) {
+    TuneState& st = state();
+    size_t before;
+    {
+        std::lock_guard<std::mutex> lk(st.lock);
+        initialize(st);
+        before = st.table.size();
+    }
+
+    // box kernels (separable) and a 3x3 sharpening kernel (not separable)
+    for (int sz : { 3, 5, 7, 0 }) {
+        const int n = sz ? sz : 3;
+        ImagePtr K = IP_allocImage(n, n, FLOATCH_TYPE);
+        ChannelPtr<float> k;
+        int type;
+        IP_getChannel(K, 0, k, type);
+        for (int i = 0; i < n * n; ++i) k[i] = sz ? 1.0f / (n * n) : (i == 4 ? 5.0f : (i & 1) ? -1.0f : 0.0f);
+        ImagePtr O;
+        HW_tunedConvolve(sample, K, O);
+    }
+    for (int sz : { 3, 5, 7, 9 }) {
+        ImagePtr O;
+        HW_tunedMedian(sample, sz, O);
+    }
+    for (int sz : { 3, 7, 15, 31, 63 }) {
+        ImagePtr O;
+        HW_tunedBlur(sample, sz, sz, O);
+    }
+    for (int method = 0; method < 2; ++method)
+        for (int serpentine = 0; serpentine < 2; ++serpentine) {
+            ImagePtr O;
+            HW_tunedErrDiffusion(sample, method, serpentine != 0, 1.0, O);
+        }
+
+    std::lock_guard<std::mutex> lk(st.lock);
+    return (int)(st.table.size() - before);
+}
+
+void HW_tuneSetFile(const char* path) {
+    TuneState& st = state();
+    std::lock_guard<std::mutex> lk(st.lock);
+    st.path = path;
+    if (st.initialized) load(st);
+}
+
+void HW_tuneSetTolerance(int tolerance) {
+    TuneState& st = state();
+    std::lock_guard<std::mutex> lk(st.lock);
+    st.tolerance = tolerance;
+}
+
+void HW_tuneOverride(const char* op, const char* variant, int threads) {
+    TuneState& st = state();
+    std::lock_guard<std::mutex> lk(st.lock);
+    initialize(st);
+    st.overrides[op] = Decision{ variant, threads, 0.0 };
+}
+
+void HW_tuneClearOverrides() {
+    TuneState& st = state();
+    std::lock_guard<std::mutex> lk(st.lock);
+    initialize(st);
+    st.overrides.clear();
+}
+
+void HW_tuneReset() {
+    TuneState& st = state();
+    std::lock_guard<std::mutex> lk(st.lock);
+    initialize(st);
+    st.table.clear();
+}
+
+void HW_tuneReport(FILE* fp) {
+    TuneState& st = state();
+    std::lock_guard<std::mutex> lk(st.lock);
+    initialize(st);
+    std::fprintf(fp, "%-32s %-10s %7s %9s   (%s)\n", "call", "variant", "threads", "ms", st.path.c_str());
+    for (const auto& e : st.table)
+        std::fprintf(fp, "%-32s %-10s %7d %9.2f\n", e.first.c_str(), e.second.variant.c_str(),
+                     e.second.threads, e.second.ms);
+    for (const auto& o : st.overrides)
+        std::fprintf(fp, "override %-23s %-10s %7d\n", o.first.c_str(), o.second.variant.c_str(), o.second.threads);
+}
@@ -0,0 +1,67 @@
+#ifndef HW_TUNE_H
+#define HW_TUNE_H
+
+#include "IP.h"
+#include <cstdio>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Runtime auto-tuner for HW_convolve, HW_median, HW_blur and HW_errDiffusion.
+//
+// HW_tunedConvolve() etc. take the arguments of the operator and run the
+// variant recorded as fastest for calls like this one:
+//   convolve      direct     HW_convolve
+//                 separable  HW_convolveSeparable (rank-1 kernels)
+//                 fixed      HW_convolveFixed (8-bit, kernels it runs in
+//                            fixed point, see HW_kernelFixedPoint)
+//   median        sort       HW_median
+//                 histogram  HW_interleavedMedian on each plane (8-bit)
+//   blur          direct     HW_blur
+//                 integral   HW_blurIntegral (8-bit)
+//                 fused8, fused32, fused128
+//                            HW_Graph blur with that many tile rows (8-bit)
+//   errDiffusion  serial     HW_errDiffusion
+//                 wavefront  HW_errDiffusionWavefront (raster scans)
+// each with 1, n/2 or n threads (n = HW_threadCount(), applied as an
+// HW_threadBudget). The first variant of each operator is its reference.
+// separable, fixed and integral may differ from the reference by 1; they
+// are candidates only while HW_tuneSetTolerance() is at least 1 (default).
+//
+// Calls are keyed by operator, parameters (kernel size and separability,
+// window size class, method and scan), image size class (powers of 4
+// from 64K pixels) and pixel type, e.g. "median/sz5/1M/u8". The first call
+// with a new key benchmarks the eligible candidates on a crop of at most
+// 1024 x 1024 of its input (best of 2 runs), records the fastest and saves
+// the table; later calls dispatch from the table. HW_tuneCalibrate() fills
+// the table on demand for images like a sample image.
+//
+// The table is a text file, one "key variant threads ms" line per entry:
+// HW_tuneSetFile(path), default $HW_TUNE_FILE or "hw_tune.txt". A table
+// recorded with a different thread count (another CPU) is ignored.
+//
+// Overrides make the dispatch deterministic (tests, reproducible runs):
+// HW_tuneOverride(op, variant, threads) forces a variant for op without
+// benchmarks or file access; op "*" with variant "reference" forces every
+// operator to its reference. The environment variable HW_TUNE sets
+// overrides at first use: "median=histogram/2,blur=direct" or "reference".
+// A forced variant that does not apply to a call falls back to the
+// reference.
+//
+
+void HW_tunedConvolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2);
+void HW_tunedMedian(ImagePtr I1, int sz, ImagePtr I2);
+void HW_tunedBlur(ImagePtr I1, int filterW, int filterH, ImagePtr I2);
+void HW_tunedErrDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, ImagePtr I2);
+
+// benchmark a standard set of parameters on images like sample; returns the number of new entries
+int  HW_tuneCalibrate(ImagePtr sample);
+
+void HW_tuneSetFile(const char* path);
+void HW_tuneSetTolerance(int tolerance);
+void HW_tuneOverride(const char* op, const char* variant, int threads = 0);
+void HW_tuneClearOverrides();
+
+// drop all decisions (and overwrite the file on the next save)
+void HW_tuneReset();
+void HW_tuneReport(FILE* fp);
+
+#endif
@@ -0,0 +1,299 @@
+#include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_parallel.h"
+#include "../common/HW_pixel.h"
+#include <vector>
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace IP;
+
+// adaptive threshold of channels of type T; the Sauvola dynamic range R
+// (128 in 8-bit units) is scaled to T's native range
+template <class T>
+static void
+adaptiveThreshold(ImagePtr I1, int method, int size, double k, ImagePtr I2)
+{
+	// make sure window size is odd and positive
+	if (size < 1) size = 1;
+	if ((size & 1) == 0) size++;
+
+	// copy image header (width, height) of input image I1 to output image I2
+	IP_copyImageHeader(I1, I2);
+
+	// init vars for width, height, and total number of pixels
+	int w = I1->width();
+	int h = I1->height();
+	int total = w * h;
+	HW_PROFILE("HW_adaptiveThreshold", (long long)total * I1->maxDepth(), 2LL * total * I1->maxDepth());
+
+	const int half = size / 2;
+	const double invArea = 1.0 / ((double)size * size);
+	const bool needDev = (method == 1 || method == 2);
+	const float invR = (float)(1.0 / (128.0 * HW_pixelScale<T>()));
+	const T white = (T)HW_PixelTraits<T>::maxVal();
+	typedef typename HW_PixelTraits<T>::Accum Accum;
+	typedef typename HW_PixelTraits<T>::Wide Wide;
+
+	// declarations for image channel pointers and datatype
+	ChannelPtr<T> p1, p2;
+	int type;
+
+	// visit all image channels and evaluate output image
+	for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
+		IP_getChannel(I2, ch, p2, type);
+		const T* in = p1;
+		T* out = p2;
+
+		HW_parallelFor(0, h, 64, [&](int y0, int y1) {
+			// column sums over rows [y-half, y+half] of the current row y,
+			// replicate-padded by half+1 columns on both sides
+			const int pw = w + 2 * half + 2;
+			std::vector<Accum> colSum(pw, 0);
+			std::vector<Wide> colSq(pw, 0);
+			std::vector<float> mean(w), dev(w);
+			HW_PROFILE_ALLOC(pw * (sizeof(Accum) + sizeof(Wide)) + w * 2 * sizeof(float));
+
+			Accum* cs = &colSum[half + 1];
+			Wide* cq = &colSq[half + 1];
+			auto addRow = [&](int y, int sign) {
+				y = (y < 0) ? 0 : (y >= h ? h - 1 : y);
+				const T* r = in + y * w;
+				if (!needDev) {
+					for (int x = 0; x < w; x++) cs[x] += sign * (Accum)r[x];
+					return;
+				}
+				for (int x = 0; x < w; x++) {
+					Accum v = sign * (Accum)r[x];
+					cs[x] += v;
+					cq[x] += (Wide)v * r[x];
+				}
+			};
+			auto padColumns = [&]() {
+				for (int x = 1; x <= half + 1; x++) {
+					cs[-x] = cs[0];	 cq[-x] = cq[0];
+					cs[w - 1 + x] = cs[w - 1];	cq[w - 1 + x] = cq[w - 1];
+				}
+			};
+
+			for (int dy = -half; dy <= half; dy++) addRow(y0 + dy, 1);
+
+			for (int y = y0; y < y1; y++) {
+				padColumns();
+
+				// slide the window along the row: mean and deviation per pixel
+				Wide sum = 0, sq = 0;
+				for (int dx = -half; dx <= half; dx++) {
+					sum += cs[dx];
+					sq  += cq[dx];
+				}
+				for (int x = 0; x < w; x++) {
+					mean[x] = (float)(sum * invArea);
+					sum += cs[x + half + 1] - cs[x - half];
+				}
+				for (int x = 0; needDev && x < w; x++) {
+					dev[x] = (float)(sq * invArea);
+					sq += cq[x + half + 1] - cq[x - half];
+				}
+
+				// local threshold and output (no loop-carried dependencies)
+				const T* r = in + y * w;
+				T* o = out + y * w;
+				const float kf = (float)k;
+				if (method == 0) {
+					const float scale = 1.0f - kf;
+					for (int x = 0; x < w; x++) o[x] = (r[x] < mean[x] * scale) ? 0 : white;
+				}
+				else {
+					for (int x = 0; x < w; x++) {
+						float m = mean[x];
+						float var = dev[x] - m * m;
+						float s = std::sqrt(var > 0.0f ? var : 0.0f);
+						float t = (method == 1) ? m + kf * s : m * (1.0f + kf * (s * invR - 1.0f));
+						o[x] = (r[x] < t) ? 0 : white;
+					}
+				}
+
+				// slide window one row down
+				if (y + 1 < y1) {
+					addRow(y + 1 + half, 1);
+					addRow(y - half, -1);
+				}
+			}
+		});
+	}
+}
+
+// largest 8-bit window whose sums of squares fit an int
+static const int kMaxIntWindow = 181;
+
+// cs[x] += a[x] - d[x] and, if cq, cq[x] += a[x]^2 - d[x]^2, x in [0,w)
+static void slideColumns(const uchar* a, const uchar* d, int w, int* cs, int* cq) {
+	int x = 0;
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 16 <= w; x += 16) {
+		const __m128i va = _mm_loadu_si128((const __m128i*)(a + x));
+		const __m128i vd = _mm_loadu_si128((const __m128i*)(d + x));
+		const __m128i lo[2] = { _mm_unpacklo_epi8(va, zero), _mm_unpackhi_epi8(va, zero) };
+		const __m128i hi[2] = { _mm_unpacklo_epi8(vd, zero), _mm_unpackhi_epi8(vd, zero) };
+		for (int j = 0; j < 2; j++) {
+			const __m128i diff = _mm_sub_epi16(lo[j], hi[j]);
+			const __m128i diff32[2] = { _mm_srai_epi32(_mm_unpacklo_epi16(diff, diff), 16),
+			                            _mm_srai_epi32(_mm_unpackhi_epi16(diff, diff), 16) };
+			__m128i* ps = (__m128i*)(cs + x + 8 * j);
+			_mm_storeu_si128(ps,     _mm_add_epi32(_mm_loadu_si128(ps),     diff32[0]));
+			_mm_storeu_si128(ps + 1, _mm_add_epi32(_mm_loadu_si128(ps + 1), diff32[1]));
+			if (!cq) continue;
+
+			// a^2 - d^2 = (a - d)(a + d), one product per 32-bit lane
+			const __m128i sum = _mm_add_epi16(lo[j], hi[j]);
+			const __m128i sq[2] = { _mm_madd_epi16(_mm_unpacklo_epi16(diff, zero), _mm_unpacklo_epi16(sum, zero)),
+			                        _mm_madd_epi16(_mm_unpackhi_epi16(diff, zero), _mm_unpackhi_epi16(sum, zero)) };
+			__m128i* pq = (__m128i*)(cq + x + 8 * j);
+			_mm_storeu_si128(pq,     _mm_add_epi32(_mm_loadu_si128(pq),     sq[0]));
+			_mm_storeu_si128(pq + 1, _mm_add_epi32(_mm_loadu_si128(pq + 1), sq[1]));
+		}
+	}
+#endif
+	for (; x < w; x++) {
+		cs[x] += a[x] - d[x];
+		if (cq) cq[x] += a[x] * a[x] - d[x] * d[x];
+	}
+}
+
+// adaptive threshold of 8-bit channels with integer window sums: 32-bit
+// column sums updated from the entering and leaving rows in one pass, and
+// for Bradley the integer test r * area * den < sum * num with num / den = 1 - k,
+// without square sums
+static void
+adaptiveThreshold8(ImagePtr I1, int method, int size, double k, ImagePtr I2)
+{
+	if (size < 1) size = 1;
+	if ((size & 1) == 0) size++;
+	IP_copyImageHeader(I1, I2);
+
+	int w = I1->width();
+	int h = I1->height();
+	int total = w * h;
+	HW_PROFILE("HW_adaptiveThreshold", (long long)total * I1->maxDepth(), 2LL * total * I1->maxDepth());
+
+	const int half = size / 2;
+	const int area = size * size;
+	const float invAreaF = 1.0f / area;
+	const bool needDev = (method == 1 || method == 2);
+	const bool sauvola = (method == 2);
+	const float invR = 1.0f / 128.0f;
+	const float kf = (float)k;
+
+	// 1 - k in units of 1/den; a threshold <= 0 sets every pixel
+	const long long den = 1 << 20;
+	const long long num = (k >= 1.0) ? 0 : (long long)std::floor((1.0 - k) * den + 0.5);
+	const long long areaDen = area * den;
+
+	ChannelPtr<uchar> p1, p2;
+	int type;
+
+	for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
+		IP_getChannel(I2, ch, p2, type);
+		const uchar* in = p1;
+		uchar* out = p2;
+
+		HW_parallelFor(0, h, 64, [&](int y0, int y1) {
+			// column sums over rows [y-half, y+half], replicate-padded
+			const int pw = w + 2 * half + 2;
+			std::vector<int> colSum(pw, 0);
+			std::vector<int> colSq(needDev ? pw : 0, 0);
+			std::vector<int> boxSum(needDev ? w : 0), boxSq(needDev ? w : 0);
+			HW_PROFILE_ALLOC((pw + 2 * w) * sizeof(int));
+
+			int* cs = &colSum[half + 1];
+			int* cq = needDev ? &colSq[half + 1] : 0;
+			auto row = [&](int y) {
+				return in + (long long)((y < 0) ? 0 : (y >= h ? h - 1 : y)) * w;
+			};
+
+			for (int dy = -half; dy <= half; dy++) {
+				const uchar* r = row(y0 + dy);
+				for (int x = 0; x < w; x++) cs[x] += r[x];
+				for (int x = 0; needDev && x < w; x++) cq[x] += r[x] * r[x];
+			}
+
+			for (int y = y0; y < y1; y++) {
+				for (int x = 1; x <= half + 1; x++) {
+					cs[-x] = cs[0];
+					cs[w - 1 + x] = cs[w - 1];
+					if (needDev) { cq[-x] = cq[0];	cq[w - 1 + x] = cq[w - 1]; }
+				}
+
+				// slide the window along the row and threshold each pixel
+				const uchar* r = in + (long long)y * w;
+				uchar* o = out + (long long)y * w;
+				int sum = 0;
+				for (int dx = -half; dx <= half; dx++) sum += cs[dx];
+				if (method == 0) {
+					for (int x = 0; x < w; x++) {
+						o[x] = (r[x] * areaDen < sum * num) ? 0 : MaxGray;
+						sum += cs[x + half + 1] - cs[x - half];
+					}
+				}
+				else {
+					int sq = 0;
+					for (int dx = -half; dx <= half; dx++) sq += cq[dx];
+					for (int x = 0; x < w; x++) {
+						boxSum[x] = sum;
+						boxSq[x] = sq;
+						sum += cs[x + half + 1] - cs[x - half];
+						sq  += cq[x + half + 1] - cq[x - half];
+					}
+
+					// area^2 * variance = area * sq - sum^2, exact in 64 bits
+					for (int x = 0; x < w; x++) {
+						const long long n = boxSum[x];
+						const float v = (float)(area * (long long)boxSq[x] - n * n);
+						const float m = boxSum[x] * invAreaF;
+						const float sd = std::sqrt(v) * invAreaF;
+						const float t = sauvola ? m * (1.0f + kf * (sd * invR - 1.0f)) : m + kf * sd;
+						o[x] = (r[x] < t) ? 0 : MaxGray;
+					}
+				}
+
+				// slide window one row down: add the entering row, drop the leaving one
+				if (y + 1 < y1) slideColumns(row(y + 1 + half), row(y - half), w, cs, cq);
+			}
+		});
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_adaptiveThreshold:
+//
+// Threshold I1 against a local threshold T computed from the mean m and
+// standard deviation s of the size x size window around each pixel.
+// Output is in I2.
+// input < T: output=0;	 input >= T: output=white (255, 65535 for 16-bit)
+//
+// method=0 (Bradley):  T = m * (1 - k)                 typical k =  0.15
+// method=1 (Niblack):  T = m + k * s                   typical k = -0.2
+// method=2 (Sauvola):  T = m * (1 + k * (s / 128 - 1)) typical k =  0.34
+//
+// Borders are replicated. Each row band keeps running column sums of the
+// pixels and their squares over the rows of the window, and slides the
+// window along each row, so the input is read once and the cost per pixel
+// does not depend on size. Row bands run in parallel. 8-bit images with
+// windows up to 181 x 181 use 32-bit integer sums, and Bradley compares
+// r * area against sum * (1 - k) in integers without square sums.
+//
+void
+HW_adaptiveThreshold(ImagePtr I1, int method, int size, double k, ImagePtr I2)
+{
+	switch (HW_pixelType(I1)) {
+	case SHORT_TYPE: adaptiveThreshold<unsigned short>(I1, method, size, k, I2); break;
+	case FLOAT_TYPE: adaptiveThreshold<float>(I1, method, size, k, I2); break;
+	default:
+		if (size <= kMaxIntWindow) adaptiveThreshold8(I1, method, size, k, I2);
+		else                       adaptiveThreshold<uchar>(I1, method, size, k, I2);
+		break;
+	}
+}
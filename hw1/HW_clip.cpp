@@ -1,15 +1,10 @@
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_pixel.h"
 using namespace IP;
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_clip:
-//
-// Clip intensities of image I1 to [t1,t2] range. Output is in I2.
-// If    input<t1: output = t1;
-// If t1<input<t2: output = input;
-// If      val>t2: output = t2;
-//
-void HW_clip(ImagePtr I1, int t1, int t2, ImagePtr I2) {
+template <class T>
+static void clip(ImagePtr I1, int t1, int t2, ImagePtr I2) {
 
     // copy image header (width, height) of the input image I1 to the output image I2
     IP_copyImageHeader(I1, I2);
@@ -19,6 +14,7 @@ void HW_clip(ImagePtr I1, int t1, int t2, ImagePtr I2) {
     int w = I1->width();
     int h = I1->height();
     int total = w * h;
+    HW_PROFILE("HW_clip", (long long)total * I1->maxDepth(), 2LL * total * I1->maxDepth() * sizeof(T));
 
     // clamp t1 and t2 to [0, 255] range
     if (t1 < 0) t1 = 0;
@@ -31,22 +27,30 @@ void HW_clip(ImagePtr I1, int t1, int t2, ImagePtr I2) {
         int temp = t1; t1 = t2; t2 = temp;
     }
 
-    // initialize lookup table
-    int lut[MXGRAY];
-    for (int i = 0; i < MXGRAY; ++i) {
-        if (i < t1) lut[i] = t1;
-        else if (i > t2) lut[i] = t2;
-        else lut[i] = i; // within [t1, t2] keep original value
-    }
+    // scale thresholds to the native range of T
+    const double lo = t1 * HW_pixelScale<T>();
+    const double hi = t2 * HW_pixelScale<T>();
 
-    ChannelPtr<uchar> p1, p2; // image channel pointer (uchar as signed doesnt matter in this case)
-    int type;
+    // apply to each channel (LUT for integer types)
+    HW_applyPointOp<T>(I1, I2, [&](double v) {
+        if (v < lo) return lo;
+        else if (v > hi) return hi;
+        else return v; // within [t1, t2] keep original value
+    });
+}
 
-    // apply LUT to each channel
-    for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
-        IP_getChannel(I2, ch, p2, type);
-        for (int i = 0; i < total; i++) {
-            *p2++ = (uchar)lut[*p1++];
-        }
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_clip:
+//
+// Clip intensities of image I1 to [t1,t2] range. Output is in I2.
+// If    input<t1: output = t1;
+// If t1<input<t2: output = input;
+// If      val>t2: output = t2;
+//
+void HW_clip(ImagePtr I1, int t1, int t2, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: clip<unsigned short>(I1, t1, t2, I2); break;
+    case FLOAT_TYPE: clip<float>(I1, t1, t2, I2); break;
+    default:         clip<uchar>(I1, t1, t2, I2); break;
     }
 }
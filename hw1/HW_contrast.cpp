@@ -1,15 +1,10 @@
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_pixel.h"
 using namespace IP;
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_contrast:
-//
-// Apply contrast enhancement to I1. Output is in I2.
-// Stretch intensity difference from reference value (128) by multiplying
-// difference by "contrast" and adding it back to 128. Shift result by
-// adding "brightness" value.
-//
-void HW_contrast(ImagePtr I1, double brightness, double contrast, ImagePtr I2) {
+template <class T>
+static void adjustContrast(ImagePtr I1, double brightness, double contrast, ImagePtr I2) {
 
     // copy image header (width, height) of the input image I1 to the output image I2
     IP_copyImageHeader(I1, I2);
@@ -18,27 +13,33 @@ void HW_contrast(ImagePtr I1, double brightness, double contrast, ImagePtr I2) {
     int w = I1->width();
     int h = I1->height();
     int total = w * h;
+    HW_PROFILE("HW_contrast", (long long)total * I1->maxDepth(), 2LL * total * I1->maxDepth() * sizeof(T));
 
-    // initialize lookup table
-    int lut[MXGRAY];
-    for (int i = 0; i < MXGRAY; ++i) {
-        // apply contrast and brightness adjustment
-        double v = (i - 128.0) * contrast + 128.0 + brightness;
-        // round to nearest integer and clamp
-        int q = (int)floor(v + 0.5);
-        if (q < 0) q = 0;
-        if (q > MaxGray) q = MaxGray;
-        lut[i] = q;
-    }
+    // reference value and brightness in the native range of T
+    const double ref = 128.0 * HW_pixelScale<T>();
+    const double shift = brightness * HW_pixelScale<T>();
 
-    ChannelPtr<uchar> p1, p2; // image channel pointer (uchar as signed doesnt matter in this case)
-    int type;
+    // apply to each channel (LUT for integer types)
+    HW_applyPointOp<T>(I1, I2, [&](double i) {
+        // apply contrast and brightness adjustment
+        double v = (i - ref) * contrast + ref + shift;
+        // round to nearest integer (clamped by HW_applyPointOp)
+        return HW_round<T>(v);
+    });
+}
 
-    // apply LUT to each channel
-    for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
-        IP_getChannel(I2, ch, p2, type);
-        for (int i = 0; i < total; i++) {
-            *p2++ = (uchar)lut[*p1++];
-        }
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_contrast:
+//
+// Apply contrast enhancement to I1. Output is in I2.
+// Stretch intensity difference from reference value (128) by multiplying
+// difference by "contrast" and adding it back to 128. Shift result by
+// adding "brightness" value.
+//
+void HW_contrast(ImagePtr I1, double brightness, double contrast, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: adjustContrast<unsigned short>(I1, brightness, contrast, I2); break;
+    case FLOAT_TYPE: adjustContrast<float>(I1, brightness, contrast, I2); break;
+    default:         adjustContrast<uchar>(I1, brightness, contrast, I2); break;
     }
 }
@@ -1,13 +1,11 @@
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_pixel.h"
 #include <cmath>
 using namespace IP;
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_gammaCorrect:
-//
-// Gamma correct image I1. Output is in I2.
-//
-void HW_gammaCorrect(ImagePtr I1, double gamma, ImagePtr I2) {
+template <class T>
+static void gammaCorrect(ImagePtr I1, double gamma, ImagePtr I2) {
 
     // copy image header (width, height) of the input image I1 to the output image I2
     IP_copyImageHeader(I1, I2);
@@ -16,28 +14,31 @@ void HW_gammaCorrect(ImagePtr I1, double gamma, ImagePtr I2) {
     int w = I1->width();
     int h = I1->height();
     int total = w * h;
+    HW_PROFILE("HW_gammaCorrect", (long long)total * I1->maxDepth(), 2LL * total * I1->maxDepth() * sizeof(T));
 
     // prevent invalid gamma values
     if (gamma <= 0.0) gamma = 1.0;
 
     double exponent = 1.0 / gamma;
+    const double maxVal = HW_PixelTraits<T>::maxVal();
 
-    // initialize lookup table
-    int lut[MXGRAY];
-    for (int i = 0; i <= MaxGray; ++i) {
+    // apply to each channel (LUT for integer types)
+    HW_applyPointOp<T>(I1, I2, [&](double i) {
         // normalized value in [0, 1]
         // apply gamma correction
-        lut[i] = MaxGray * pow(((double) i/ MaxGray), exponent);
-    }
-
-    ChannelPtr<uchar> p1, p2; // image channel pointer (uchar as signed doesnt matter in this case)
-    int type;
+        return maxVal * pow(i / maxVal, exponent);
+    });
+}
 
-    // apply LUT to each channel
-    for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
-        IP_getChannel(I2, ch, p2, type);
-        for (int i = 0; i < total; i++) {
-            *p2++ = (uchar)lut[*p1++];
-        }
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_gammaCorrect:
+//
+// Gamma correct image I1. Output is in I2.
+//
+void HW_gammaCorrect(ImagePtr I1, double gamma, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: gammaCorrect<unsigned short>(I1, gamma, I2); break;
+    case FLOAT_TYPE: gammaCorrect<float>(I1, gamma, I2); break;
+    default:         gammaCorrect<uchar>(I1, gamma, I2); break;
     }
 }
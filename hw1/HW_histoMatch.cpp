@@ -1,57 +1,113 @@
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_histogram.h"
+#include "../common/HW_pixel.h"
 #include <vector>
 #include <cmath>
-#include <cstring>
+#include <algorithm>
 using namespace IP;
 
 void histoMatchApprox(ImagePtr, ImagePtr, ImagePtr);
 
 // helper functions for histogram matching
 
-// read the histogram shape
-static void readTargetHisto(ImagePtr targetHisto, double tgt[MXGRAY]) {
-	for (int i = 0; i < MXGRAY; ++i) tgt[i] = 0.0;
+// number of histogram bins for pixel type T: one per value for integer
+// types (256 or 65536), 256 bins of the 8-bit scale for float
+template <class T>
+static int binCount() {
+	return HW_PixelTraits<T>::isInteger ? (int)HW_PixelTraits<T>::lutSize : MXGRAY;
+}
+
+template <class T>
+static inline int binOf(T v) {
+	return HW_PixelTraits<T>::isInteger ? (int)v : HW_histogramBin(v);
+}
+
+// read the histogram shape (256 entries), spread evenly over binCount<T>() bins
+template <class T>
+static void readTargetHisto(ImagePtr targetHisto, std::vector<double>& tgt) {
+	const int bins = binCount<T>();
+	tgt.assign(bins, 0.0);
 
 	ChannelPtr<uchar> p;
 	int type;
 	if (!IP_getChannel(targetHisto, 0, p, type)) return;
 
+	double raw[MXGRAY];
+	for (int i = 0; i < MXGRAY; ++i) raw[i] = 0.0;
 	int total = targetHisto->width() * targetHisto->height();
 	int cnt = (total < MXGRAY) ? total : MXGRAY;
-	for (int i = 0; i < cnt; ++i) tgt[i] = (double)p[i];
+	for (int i = 0; i < cnt; ++i) raw[i] = (double)p[i];
+
+	const int per = bins / MXGRAY;
+	for (int i = 0; i < bins; ++i) tgt[i] = raw[i / per] / per;
 }
 
 // build input histogram for channel ch and return Nch
-static int buildInputHistogram(ImagePtr I, int ch, int H[MXGRAY]) {
-	std::memset(H, 0, MXGRAY * sizeof(int));
-	ChannelPtr<uchar> p;
+template <class T>
+static int buildInputHistogram(ImagePtr I, int ch, std::vector<int>& H) {
+	ChannelPtr<T> p;
 	int type;
 	IP_getChannel(I, ch, p, type);
 
 	int N = I->width() * I->height();
-	for (int i = 0; i < N; ++i) ++H[p[i]];
+	H.assign(binCount<T>(), 0);
+	if (sizeof(T) == 1) {
+		HW_histogram((const uchar*)(T*)p, N, &H[0]);
+		return N;
+	}
+	for (int i = 0; i < N; ++i) ++H[binOf<T>(p[i])];
 	return N;
 }
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_histoMatch:
-//
-// Apply histogram matching to I1. Output is in I2.
-//
-void HW_histoMatch(ImagePtr I1, ImagePtr targetHisto, bool approxAlg, ImagePtr I2) {
-	if (approxAlg) {
-		histoMatchApprox(I1, targetHisto, I2);
-		return;
+// input histogram of channel ch from the pixels selected by the histogram
+// sampling setting (all pixels when sampling is off); returns the sample count
+template <class T>
+static int sampleInputHistogram(ImagePtr I, int ch, std::vector<int>& H) {
+	ChannelPtr<T> p;
+	int type;
+	IP_getChannel(I, ch, p, type);
+
+	const int w = I->width(), h = I->height();
+	const HW_HistogramSampling& s = HW_histogramSampling();
+	if (s.rowStride <= 1 && (s.budget <= 0 || s.budget >= (long long)w * h))
+		return buildInputHistogram<T>(I, ch, H);
+
+	H.assign(binCount<T>(), 0);
+	int* bins = &H[0];
+	long long n = HW_samplePixels((const T*)p, w, h, [&](T v) { ++bins[binOf<T>(v)]; });
+	HW_histogramNoteSamples(n, (long long)w * h);
+	return (int)n;
+}
+
+// scale the target shape tgtRaw (sum sumRaw > 0) to counts summing to total by
+// rounding the cumulative counts: per-bin rounding over 65536 bins leaves a
+// remainder of up to bins/2 that piles up in one bin, this spreads it evenly
+static void scaleTargetCumulative(const std::vector<double>& tgtRaw, double sumRaw, int total,
+	std::vector<int>& counts) {
+	const int bins = (int)tgtRaw.size();
+	const double scale = (double)total / sumRaw;
+	double cum = 0.0;
+	int prev = 0;
+	for (int i = 0; i < bins; ++i) {
+		cum += tgtRaw[i] * scale;
+		int next = (i == bins - 1) ? total : std::min((int)std::floor(cum + 0.5), total);
+		counts[i] = next - prev;
+		prev = next;
 	}
+}
 
-	// exact histogram matching
+// exact histogram matching
+template <class T>
+static void histoMatchExact(ImagePtr I1, ImagePtr targetHisto, ImagePtr I2) {
 	IP_copyImageHeader(I1, I2);
 
 	// read target shape
-	double tgtRaw[MXGRAY];
-	readTargetHisto(targetHisto, tgtRaw);
+	const int bins = binCount<T>();
+	std::vector<double> tgtRaw;
+	readTargetHisto<T>(targetHisto, tgtRaw);
 
-	ChannelPtr<uchar> pIn, pOut;
+	ChannelPtr<T> pIn, pOut;
 	int type;
 
 	for (int ch = 0; IP_getChannel(I1, ch, pIn, type); ch++) {
@@ -62,49 +118,53 @@ void HW_histoMatch(ImagePtr I1, ImagePtr targetHisto, bool approxAlg, ImagePtr I
 		const int total = W * Hh;
 
 		// histo1
-		int histo1[MXGRAY];
-		buildInputHistogram(I1, ch, histo1);
+		std::vector<int> histo1;
+		buildInputHistogram<T>(I1, ch, histo1);
 
 		// scale target to total pixels
-		int histo2[MXGRAY];
+		std::vector<int> histo2(bins);
 		// sum raw
 		double sumRaw = 0.0;
-		for (int i = 0; i < MXGRAY; ++i) sumRaw += tgtRaw[i];
+		for (int i = 0; i < bins; ++i) sumRaw += tgtRaw[i];
 
 		if (sumRaw <= 0.0) {
 			// flatten
-			int base = total / MXGRAY, rem = total % MXGRAY;
-			for (int i = 0; i < MXGRAY; ++i) histo2[i] = base + (i < rem ? 1 : 0);
+			int base = total / bins, rem = total % bins;
+			for (int i = 0; i < bins; ++i) histo2[i] = base + (i < rem ? 1 : 0);
+		}
+		else if (bins > MXGRAY) {
+			// 16-bit
+			scaleTargetCumulative(tgtRaw, sumRaw, total, histo2);
 		}
 		else {
 			// scale
 			double scale = (double)total / sumRaw;
 			int partial = 0;
-			for (int i = 0; i < MXGRAY; ++i) {
+			for (int i = 0; i < bins; ++i) {
 				histo2[i] = (int)std::floor(tgtRaw[i] * scale + 0.5); // round
 				partial += histo2[i];
 				if (partial > total) {
 					// clamp this bin and zero the rest
 					int overshoot = partial - total;
 					histo2[i] -= overshoot;
-					for (int j = i + 1; j < MXGRAY; ++j) histo2[j] = 0;
+					for (int j = i + 1; j < bins; ++j) histo2[j] = 0;
 					partial = total;
 					break;
 				}
 			}
 
 			// if under, give the remainder to the last bin
-			if (partial < total) histo2[MXGRAY - 1] += (total - partial);
+			if (partial < total) histo2[bins - 1] += (total - partial);
 		}
 
 		// build left right intervals
-		int left[MXGRAY], right[MXGRAY];
+		std::vector<int> left(bins), right(bins);
 		int r = 0;
 		long Hsum = 0;
-		for (int i = 0; i < MXGRAY; ++i) {
+		for (int i = 0; i < bins; ++i) {
 			left[i] = r;
 			Hsum += histo1[i];
-			while (Hsum > histo2[r] && r < MXGRAY - 1) {
+			while (Hsum > histo2[r] && r < bins - 1) {
 				Hsum -= histo2[r];
 				++r;
 			}
@@ -113,136 +173,208 @@ void HW_histoMatch(ImagePtr I1, ImagePtr targetHisto, bool approxAlg, ImagePtr I
 
 
 		// reuse histo1 for output bins
-		std::memset(histo1, 0, MXGRAY * sizeof(int));
+		std::fill(histo1.begin(), histo1.end(), 0);
 
 		IP_getChannel(I1, ch, pIn, type);
 		IP_getChannel(I2, ch, pOut, type);
 
 		// remap pixels
 		for (int k = 0; k < total; ++k) {
-			int in = pIn[k];
+			int in = binOf<T>(pIn[k]);
 			int p = left[in];
 
 			if (histo1[p] < histo2[p]) {
-				pOut[k] = (uchar)p;
+				pOut[k] = (T)p;
 			}
 			else {
 				int nextp = p + 1;
 				if (nextp > right[in]) nextp = right[in];
 				p = left[in] = nextp;
-				pOut[k] = (uchar)p;
+				pOut[k] = (T)p;
 			}
 			++histo1[p];
 		}
 	}
 }
 
-void histoMatchApprox(ImagePtr I1, ImagePtr targetHisto, ImagePtr I2) {
+// CDF matching LUT from an input histogram Hin of N pixels and the target shape tgtRaw
+template <class T>
+static void cdfMatchLut(const std::vector<int>& Hin, int N, const std::vector<double>& tgtRaw, std::vector<int>& LUT) {
+	const int bins = binCount<T>();
+
+	// scaled target counts
+	//int T[MXGRAY];
+
+	// scaling
+	//double sumRaw = 0.0;
+	//for (int i = 0; i < MXGRAY; ++i) sumRaw += tgtRaw[i];
+	//long long acc = 0;
+	//if (sumRaw <= 0.0) {
+	//	int base = N / MXGRAY, rem = N % MXGRAY;
+	//	for (int i = 0; i < MXGRAY; ++i) {
+	//		T[i] = base + (i < rem ? 1 : 0);
+	//	}
+	//} else {
+	//	for (int i = 0; i < MXGRAY - 1; ++i) {
+	//		T[i] = (int)std::floor(tgtRaw[i] * ((double)N / sumRaw) + 0.5);
+	//		acc += T[i];
+	//	}
+	//	T[MXGRAY - 1] = (int)N - int(acc);
+	//	if (T[MXGRAY - 1] < 0) T[MXGRAY - 1] = 0;
+	//}
+
+	// scaled target counts
+	std::vector<int> Tc(bins, 0);
+
+	// compute scaling
+	double sumRaw = 0.0;
+	for (int i = 0; i < bins; ++i) sumRaw += tgtRaw[i];
+
+	if (sumRaw <= 0.0) {
+		int base = N / bins, rem = N % bins;
+		for (int i = 0; i < bins; ++i) Tc[i] = base + (i < rem ? 1 : 0);
+	}
+	else if (bins > MXGRAY) {
+		// 16-bit
+		scaleTargetCumulative(tgtRaw, sumRaw, N, Tc);
+	}
+	else {
+		double scale = (double)N / sumRaw;
+
+		int running = 0;
+		int lastNonZero = -1;
+
+		for (int i = 0; i < bins; ++i) {
+			// round each bin
+			int ti = (int)std::floor(tgtRaw[i] * scale + 0.5);
+			if (ti < 0) ti = 0;
+
+			Tc[i] = ti;
+			if (ti > 0) lastNonZero = i;
+
+			running += ti;
+			if (running > N) {
+				// zero the remaining
+				int extra = running - N;
+				Tc[i] -= extra;
+				for (int k = i + 1; k < bins; ++k) Tc[k] = 0;
+				running = N;
+				break;
+			}
+		}
 
+		if (running < N) {
+			int idx = (lastNonZero >= 0) ? lastNonZero : (bins - 1);
+			Tc[idx] += (N - running);
+		}
+	}
+
+
+	// build cdfs
+	std::vector<double> Cin(bins), Ctgt(bins);
+	double run = 0.0, inv = (N > 0) ? 1.0 / N : 0.0;
+	for (int i = 0; i < bins; ++i) { run += (double)Hin[i]; Cin[i] = run * inv; }
+	run = 0.0;
+	for (int i = 0; i < bins; ++i) { run += (double)Tc[i]; Ctgt[i] = (N > 0) ? run / (double)N : 0.0; }
+
+	// LUT through CDF matching
+	LUT.resize(bins);
+	int j = 0;
+	for (int i = 0; i < bins; ++i) {
+		double s = Cin[i];
+		while (j < bins - 1 && Ctgt[j] < s) ++j;
+		if (j == 0) LUT[i] = 0;
+		else {
+			double d1 = std::fabs(Ctgt[j] - s);
+			double d0 = std::fabs(Ctgt[j - 1] - s);
+			LUT[i] = (d0 <= d1) ? (j - 1) : j;
+		}
+	}
+}
+
+// approximate histogram matching through the CDFs
+template <class T>
+static void histoMatchCdf(ImagePtr I1, ImagePtr targetHisto, ImagePtr I2) {
 	IP_copyImageHeader(I1, I2);
 
 	// target histogram
-	double tgtRaw[MXGRAY];
-	readTargetHisto(targetHisto, tgtRaw);
+	std::vector<double> tgtRaw;
+	readTargetHisto<T>(targetHisto, tgtRaw);
 
-	ChannelPtr<uchar> pIn, pOut;
+	ChannelPtr<T> pIn, pOut;
 	int type;
 
 	for (int ch = 0; IP_getChannel(I1, ch, pIn, type); ch++) {
 		IP_getChannel(I2, ch, pOut, type);
 
 		// input histogram
-		int Hin[MXGRAY];
-		int N = buildInputHistogram(I1, ch, Hin);
-
-		// scaled target counts
-		//int T[MXGRAY];
-
-		// scaling
-		//double sumRaw = 0.0;
-		//for (int i = 0; i < MXGRAY; ++i) sumRaw += tgtRaw[i];
-		//long long acc = 0;
-		//if (sumRaw <= 0.0) {
-		//	int base = N / MXGRAY, rem = N % MXGRAY;
-		//	for (int i = 0; i < MXGRAY; ++i) {
-		//		T[i] = base + (i < rem ? 1 : 0);
-		//	}
-		//} else {
-		//	for (int i = 0; i < MXGRAY - 1; ++i) {
-		//		T[i] = (int)std::floor(tgtRaw[i] * ((double)N / sumRaw) + 0.5);
-		//		acc += T[i];
-		//	}
-		//	T[MXGRAY - 1] = (int)N - int(acc);
-		//	if (T[MXGRAY - 1] < 0) T[MXGRAY - 1] = 0;
-		//}
-
-		// scaled target counts
-		int T[MXGRAY];
-		std::memset(T, 0, sizeof(T));
-
-		// compute scaling
-		double sumRaw = 0.0;
-		for (int i = 0; i < MXGRAY; ++i) sumRaw += tgtRaw[i];
-
-		if (sumRaw <= 0.0) {
-			int base = N / MXGRAY, rem = N % MXGRAY;
-			for (int i = 0; i < MXGRAY; ++i) T[i] = base + (i < rem ? 1 : 0);
-		}
-		else {
-			double scale = (double)N / sumRaw;
-
-			int running = 0;
-			int lastNonZero = -1;
-
-			for (int i = 0; i < MXGRAY; ++i) {
-				// round each bin
-				int ti = (int)std::floor(tgtRaw[i] * scale + 0.5);
-				if (ti < 0) ti = 0;
-
-				T[i] = ti;
-				if (ti > 0) lastNonZero = i;
-
-				running += ti;
-				if (running > N) {
-					// zero the remaining
-					int extra = running - N;
-					T[i] -= extra;
-					for (int k = i + 1; k < MXGRAY; ++k) T[k] = 0;
-					running = N;
-					break;
-				}
-			}
-
-			if (running < N) {
-				int idx = (lastNonZero >= 0) ? lastNonZero : (MXGRAY - 1);
-				T[idx] += (N - running);
-			}
-		}
+		std::vector<int> Hin;
+		int N = sampleInputHistogram<T>(I1, ch, Hin);
 
+		std::vector<int> LUT;
+		cdfMatchLut<T>(Hin, N, tgtRaw, LUT);
 
-		// build cdfs
-		double Cin[MXGRAY], Ctgt[MXGRAY];
-		double run = 0.0, inv = (N > 0) ? 1.0 / N : 0.0;
-		for (int i = 0; i < MXGRAY; ++i) { run += (double)Hin[i]; Cin[i] = run * inv; }
-		run = 0.0;
-		for (int i = 0; i < MXGRAY; ++i) { run += (double)T[i]; Ctgt[i] = (N > 0) ? run / (double)N : 0.0; }
-
-		// LUT through CDF matching
-		int LUT[MXGRAY];
-		int j = 0;
-		for (int i = 0; i < MXGRAY; ++i) {
-			double s = Cin[i];
-			while (j < MXGRAY - 1 && Ctgt[j] < s) ++j;
-			if (j == 0) LUT[i] = 0;
-			else {
-				double d1 = std::fabs(Ctgt[j] - s);
-				double d0 = std::fabs(Ctgt[j - 1] - s);
-				LUT[i] = (d0 <= d1) ? (j - 1) : j;
-			}
-		}
-		// apply LUT
+		// apply LUT to every pixel (N counts only the samples when sampling)
+		const int total = I1->width() * I1->height();
 		IP_getChannel(I1, ch, pIn, type);
 		IP_getChannel(I2, ch, pOut, type);
-		for (int k = 0; k < N; ++k) pOut[k] = (uchar)LUT[pIn[k]];
+		for (int k = 0; k < total; ++k) pOut[k] = (T)LUT[binOf<T>(pIn[k])];
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_histoMatch:
+//
+// Apply histogram matching to I1. Output is in I2.
+// 16-bit channels are matched over all 65536 values, with each entry of the
+// 256-entry target histogram spread evenly over its 256 native values.
+// Float channels are matched over 256 bins of the 8-bit scale.
+// With histogram sampling enabled (HW_setHistogramSampling), the approximate
+// algorithm estimates the input CDF from a subsample and still maps every
+// pixel; HW_histogramCdfError() on the calling thread then gives a rough size
+// of the CDF error of the last channel matched.
+//
+void HW_histoMatch(ImagePtr I1, ImagePtr targetHisto, bool approxAlg, ImagePtr I2) {
+	const long long pixels = (long long)I1->width() * I1->height() * I1->maxDepth();
+	HW_PROFILE("HW_histoMatch", pixels, 3 * pixels);
+
+	if (approxAlg) {
+		histoMatchApprox(I1, targetHisto, I2);
+		return;
 	}
+
+	switch (HW_pixelType(I1)) {
+	case SHORT_TYPE: histoMatchExact<unsigned short>(I1, targetHisto, I2); break;
+	case FLOAT_TYPE: histoMatchExact<float>(I1, targetHisto, I2); break;
+	default:         histoMatchExact<uchar>(I1, targetHisto, I2); break;
+	}
+}
+
+void histoMatchApprox(ImagePtr I1, ImagePtr targetHisto, ImagePtr I2) {
+	const long long pixels = (long long)I1->width() * I1->height() * I1->maxDepth();
+	HW_PROFILE("histoMatchApprox", pixels, 3 * pixels);
+
+	switch (HW_pixelType(I1)) {
+	case SHORT_TYPE: histoMatchCdf<unsigned short>(I1, targetHisto, I2); break;
+	case FLOAT_TYPE: histoMatchCdf<float>(I1, targetHisto, I2); break;
+	default:         histoMatchCdf<uchar>(I1, targetHisto, I2); break;
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_histoMatchLut:
+//
+// 8-bit LUT of histoMatchApprox() for a channel with histogram H, so that
+// callers that already have the histogram (e.g. interleaved buffers) can
+// apply the match without a planar image.
+//
+void HW_histoMatchLut(const int H[MXGRAY], ImagePtr targetHisto, uchar lut[MXGRAY]) {
+	std::vector<double> tgtRaw;
+	readTargetHisto<uchar>(targetHisto, tgtRaw);
+
+	std::vector<int> Hin(H, H + MXGRAY), LUT;
+	int N = 0;
+	for (int i = 0; i < MXGRAY; ++i) N += H[i];
+	cdfMatchLut<uchar>(Hin, N, tgtRaw, LUT);
+	for (int i = 0; i < MXGRAY; ++i) lut[i] = (uchar)LUT[i];
 }
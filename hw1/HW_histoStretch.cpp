@@ -1,13 +1,11 @@
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_histogram.h"
+#include "../common/HW_pixel.h"
 using namespace IP;
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_histoStretch:
-//
-// Apply histogram stretching to I1. Output is in I2.
-// Stretch intensity values between t1 and t2 to fill the range [0,255].
-//
-void HW_histoStretch(ImagePtr I1, int t1, int t2, ImagePtr I2) {
+template <class T>
+static void histoStretch(ImagePtr I1, int t1, int t2, ImagePtr I2) {
 
     // copy image header (width, height) of the input image I1 to the output image I2
     IP_copyImageHeader(I1, I2);
@@ -16,6 +14,7 @@ void HW_histoStretch(ImagePtr I1, int t1, int t2, ImagePtr I2) {
     int w = I1->width();
     int h = I1->height();
     int total = w * h;
+    HW_PROFILE("HW_histoStretch", (long long)total * I1->maxDepth(), 2LL * total * I1->maxDepth() * sizeof(T));
 
     // clamp t1 and t2 to [0, 255] range
     if (t1 < 0) t1 = 0;
@@ -30,34 +29,56 @@ void HW_histoStretch(ImagePtr I1, int t1, int t2, ImagePtr I2) {
         t2 = temp;
     }
 
-    // initialize lookup table
-    int lut[MXGRAY];
     int delta = t2 - t1;
     if (delta <= 0) delta = 1; // prevent division by zero
 
-    for (int i = 0; i < MXGRAY; ++i) {
-        int q;
-        if (i < t1) q = 0;
-        else if (i > t2) q = MaxGray;
-        else {
-            // stretch to [0, 255]
-            double v = (double)(i - t1) * MaxGray / (double)delta;
-            // round to nearest integer and clamp
-            q = (int)(v + 0.5);
-            if (q < 0) q = 0;
-            if (q > MaxGray) q = MaxGray;
-        }
-        lut[i] = q;
-    }
+    // thresholds and range in native units of T
+    const double scale = HW_pixelScale<T>();
+    const double lo = t1 * scale, hi = t2 * scale, span = delta * scale;
+    const double maxVal = HW_PixelTraits<T>::maxVal();
+
+    // apply to each channel (LUT for integer types)
+    HW_applyPointOp<T>(I1, I2, [&](double i) {
+        if (i < lo) return 0.0;
+        else if (i > hi) return maxVal;
+
+        // stretch to [0, maxVal]
+        double v = (i - lo) * maxVal / span;
+        // round to nearest integer (clamped by HW_applyPointOp)
+        return HW_round<T>(v);
+    });
+}
 
-    ChannelPtr<uchar> p1, p2; // image channel pointer (uchar as signed doesnt matter in this case)
-    int type;
-    // apply LUT to each channel
-    for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
-        IP_getChannel(I2, ch, p2, type);
-        for (int i = 0; i < total; i++) {
-            *p2++ = (uchar)lut[*p1++];
-        }
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_histoStretch:
+//
+// Apply histogram stretching to I1. Output is in I2.
+// Stretch intensity values between t1 and t2 to fill the range [0,255].
+//
+void HW_histoStretch(ImagePtr I1, int t1, int t2, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: histoStretch<unsigned short>(I1, t1, t2, I2); break;
+    case FLOAT_TYPE: histoStretch<float>(I1, t1, t2, I2); break;
+    default:         histoStretch<uchar>(I1, t1, t2, I2); break;
     }
 }
 
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_histoStretchAuto:
+//
+// Apply histogram stretching to I1 with t1/t2 taken from the histogram:
+// t1 is the loPct percentile and t2 the hiPct percentile (e.g. 1 and 99),
+// so outliers at both ends are clipped. Output is in I2.
+//
+void HW_histoStretchAuto(ImagePtr I1, double loPct, double hiPct, ImagePtr I2) {
+
+    // one histogram pass over all channels
+    long long histo[MXGRAY];
+    HW_imageHistogram(I1, histo);
+
+    int t1 = HW_percentile(histo, loPct);
+    int t2 = HW_percentile(histo, hiPct);
+
+    // one LUT pass
+    HW_histoStretch(I1, t1, t2, I2);
+}
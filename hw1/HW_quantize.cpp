@@ -1,15 +1,15 @@
 #include "IP.h"
+#include "../common/HW_histogram.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_parallel.h"
+#include "../common/HW_pixel.h"
 #include <cstdlib>
 #include <cmath>
+#include <vector>
 using namespace IP;
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_quantize:
-//
-// Quantize I1 to specified number of levels. Apply dither if flag is set.
-// Output is in I2.
-//
-void HW_quantize(ImagePtr I1, int levels, bool dither, ImagePtr I2) {
+template <class T>
+static void quantize(ImagePtr I1, int levels, bool dither, ImagePtr I2) {
 
     // copy image header (width, height) of the input image I1 to the output image I2
     IP_copyImageHeader(I1, I2);
@@ -18,44 +18,38 @@ void HW_quantize(ImagePtr I1, int levels, bool dither, ImagePtr I2) {
     int w = I1->width();
     int h = I1->height();
     int total = w * h;
+    HW_PROFILE("HW_quantize", (long long)total * I1->maxDepth(), 2LL * total * I1->maxDepth() * sizeof(T));
 
     // clamp levels to be at least 2
     if (levels < 2) levels = 2;
     if (levels > MXGRAY) levels = MXGRAY;
 
     // compute uniform bin size and midpoint bias
-    // step size = 256 / levels, levels = 128 / levels
-    double step = 256.0 / levels;
-    double bias = 128.0 / levels;
-
-    ChannelPtr<uchar> p1, p2; // image channel pointer (uchar as signed doesnt matter in this case)
+    // step size = range / levels, bias = (range / 2) / levels
+    // (range = 256 for uchar and float, 65536 for 16-bit)
+    const double range = HW_pixelRange<T>();
+    const double maxVal = HW_PixelTraits<T>::maxVal();
+    double step = range / levels;
+    double bias = range / 2 / levels;
+
+    // midpoint of the bin of value v
+    auto binMid = [&](double v) {
+        int k = (int)(v / step);
+        if (k >= levels) k = levels - 1; // clamp to max level
+
+        // midpoint of bin k = bias + k * step
+        double mid = bias + k * step;
+
+        // round to nearest integer (clamped by caller)
+        return HW_round<T>(mid);
+    };
+
+    ChannelPtr<T> p1, p2; // image channel pointer
     int type;
 
     if (!dither) {
-        // if no dithering, use lookup table
-        int lut[MXGRAY];
-        for (int i = 0; i < MXGRAY; ++i) {
-            int k = (int)(i / step);
-            if (k >= levels) k = levels - 1; // clamp to max level
-
-            // midpoint of bin k = bias + k * step
-            double mid = bias + k * step;
-
-            // round to nearest integer and clamp
-            int q = (int)(mid + 0.5);
-            if (q < 0) q = 0;
-            if (q > MaxGray) q = MaxGray;
-
-            lut[i] = q;
-        }
-
-        // apply LUT to each channel
-        for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
-            IP_getChannel(I2, ch, p2, type);
-            for (int i = 0; i < total; i++) {
-                *p2++ = (uchar)lut[*p1++];
-            }
-        }
+        // if no dithering, use lookup table (direct math for float)
+        HW_applyPointOp<T>(I1, I2, binMid);
     }
     else {
         // if dithering
@@ -82,23 +76,92 @@ void HW_quantize(ImagePtr I1, int levels, bool dither, ImagePtr I2) {
                 }
                 addSign = !addSign;
 
-                // clamp vj to [0, 255]
+                // clamp vj to [0, maxVal]
                 if (vj < 0.0) vj = 0.0;
-                if (vj > 255.0) vj = 255.0;
-                 
-                // find bin index for jittered value
-                int k = (int)(vj / step);
-                if (k >= levels) k = levels - 1; // clamp to max level
-
-                // midpoint of bin k, rounded
-                double mid = bias + k * step;
-                int q = (int)(mid + 0.5);
-                if (q < 0) q = 0;
-                if (q > MaxGray) q = MaxGray;
-
-                *p2++ = (uchar)q;
+                if (vj > maxVal) vj = maxVal;
+
+                // midpoint of the bin of the jittered value, rounded
+                *p2++ = HW_clampPixel<T>(binMid(vj));
             }
 
         }
     }
 }
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_quantize:
+//
+// Quantize I1 to specified number of levels. Apply dither if flag is set.
+// Output is in I2.
+//
+void HW_quantize(ImagePtr I1, int levels, bool dither, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: quantize<unsigned short>(I1, levels, dither, I2); break;
+    case FLOAT_TYPE: quantize<float>(I1, levels, dither, I2); break;
+    default:         quantize<uchar>(I1, levels, dither, I2); break;
+    }
+}
+
+template <class T>
+static void quantizeAdaptive(ImagePtr I1, int levels, ImagePtr I2) {
+    IP_copyImageHeader(I1, I2);
+
+    const int total = I1->width() * I1->height();
+    HW_PROFILE("HW_quantizeAdaptive", (long long)total * I1->maxDepth(), 3LL * total * I1->maxDepth() * sizeof(T));
+
+    if (levels < 2) levels = 2;
+    if (levels > MXGRAY) levels = MXGRAY;
+
+    // bins of 16-bit and float values span [v, v+1) in 8-bit units: use their centers
+    const double scale = HW_pixelScale<T>();
+    const double center = (HW_pixelType(I1) == UCHAR_TYPE) ? 0.0 : 0.5;
+
+    ChannelPtr<T> p1, p2;
+    int type;
+    for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
+        IP_getChannel(I2, ch, p2, type);
+
+        // levels of least squared error over this channel's histogram bins
+        long long histo[MXGRAY];
+        double rep[MXGRAY];
+        int level[MXGRAY];
+        HW_channelHistogram(I1, ch, histo);
+        HW_lloydMax(histo, levels, rep, level);
+
+        T binValue[MXGRAY];
+        for (int v = 0; v < MXGRAY; ++v)
+            binValue[v] = HW_clampPixel<T>(HW_round<T>((rep[level[v]] + center) * scale));
+
+        // one LUT pass (per pixel for float)
+        std::vector<T> lut(HW_PixelTraits<T>::lutSize);
+        for (int i = 0; i < (int)lut.size(); ++i) lut[i] = binValue[HW_histogramBin(i / scale)];
+        const T* src = p1;
+        T* dst = p2;
+        HW_parallelFor(0, total, 1 << 16, [&](int lo, int hi) {
+            if (HW_PixelTraits<T>::isInteger) {
+                for (int i = lo; i < hi; ++i) dst[i] = lut[(int)src[i]];
+            }
+            else {
+                for (int i = lo; i < hi; ++i) dst[i] = binValue[HW_histogramBin(src[i] / scale)];
+            }
+        });
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_quantizeAdaptive:
+//
+// Quantize I1 to the specified number of levels, placed where the pixels
+// are: each channel gets the levels of least squared error for its own
+// 256-bin histogram (HW_lloydMax), so sparse ranges do not use up levels. The
+// levels are found from the histogram alone, independently of image
+// size, and applied as a LUT in one pass like HW_quantize.
+// Output is in I2.
+//
+void HW_quantizeAdaptive(ImagePtr I1, int levels, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: quantizeAdaptive<unsigned short>(I1, levels, I2); break;
+    case FLOAT_TYPE: quantizeAdaptive<float>(I1, levels, I2); break;
+    default:         quantizeAdaptive<uchar>(I1, levels, I2); break;
+    }
+}
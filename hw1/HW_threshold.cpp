@@ -1,6 +1,33 @@
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_histogram.h"
+#include "../common/HW_pixel.h"
 using namespace IP;
 
+template <class T>
+static void
+threshold(ImagePtr I1, int thr, ImagePtr I2)
+{
+	// copy image header (width, height) of input image I1 to output image I2
+	IP_copyImageHeader(I1, I2);
+
+	// init vars for width, height, and total number of pixels
+	int w = I1->width();
+	int h = I1->height();
+	int total = w * h;
+	HW_PROFILE("HW_threshold", (long long)total * I1->maxDepth(), 2LL * total * I1->maxDepth() * sizeof(T));
+
+	// threshold and output level in native units of T
+	const double t = thr * HW_pixelScale<T>();
+	const double maxVal = HW_PixelTraits<T>::maxVal();
+
+	// Note: the pixel datatype (uchar, short, float) of the channels is returned by
+	// IP_getChannel() in type; HW_threshold() dispatches on it to instantiate T.
+
+	// visit all image channels and evaluate output image (lut[] for integer types)
+	HW_applyPointOp<T>(I1, I2, [&](double i) { return (i < t) ? 0.0 : maxVal; });
+}
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // HW_threshold:
 //
@@ -10,31 +37,76 @@ using namespace IP;
 void
 HW_threshold(ImagePtr I1, int thr, ImagePtr I2)
 {
-	// copy image header (width, height) of input image I1 to output image I2
+	switch (HW_pixelType(I1)) {
+	case SHORT_TYPE: threshold<unsigned short>(I1, thr, I2); break;
+	case FLOAT_TYPE: threshold<float>(I1, thr, I2); break;
+	default:         threshold<uchar>(I1, thr, I2); break;
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_thresholdOtsu:
+//
+// Threshold I1 at the Otsu threshold of its histogram (all channels).
+// Output is in I2. Returns the threshold used.
+//
+int
+HW_thresholdOtsu(ImagePtr I1, ImagePtr I2)
+{
+	long long histo[MXGRAY];
+	HW_imageHistogram(I1, histo);
+
+	int thr = HW_otsuThreshold(histo);
+	HW_threshold(I1, thr, I2);
+	return thr;
+}
+
+template <class T>
+static void
+thresholdMultiOtsu(ImagePtr I1, int levels, ImagePtr I2)
+{
 	IP_copyImageHeader(I1, I2);
 
-	// init vars for width, height, and total number of pixels
 	int w = I1->width();
 	int h = I1->height();
 	int total = w * h;
+	HW_PROFILE("HW_thresholdMultiOtsu", (long long)total * I1->maxDepth(), 3LL * total * I1->maxDepth() * sizeof(T));
 
-	// init lookup table
-	int i, lut[MXGRAY];
-	for (i = 0; i < thr && i < MXGRAY; ++i) lut[i] = 0;
-	for (; i < MXGRAY; ++i) lut[i] = MaxGray;
+	long long histo[MXGRAY];
+	HW_imageHistogram(I1, histo);
 
-	// declarations for image channel pointers and datatype
-	ChannelPtr<uchar> p1, p2;
-	int type;
+	int thr[8];
+	levels = HW_multiOtsuThresholds(histo, levels, thr);
 
-	// Note: IP_getChannel(I, ch, p1, type) gets pointer p1 of channel ch in image I.
-	// The pixel datatype (e.g., uchar, short, ...) of that channel is returned in type.
-	// It is ignored here since we assume that our input images consist exclusively of uchars.
-	// IP_getChannel() returns 1 when channel ch exists, 0 otherwise.
+	// init 8-bit table: one output level per class
+	int i = 0, cls[MXGRAY];
+	for (int k = 0; k < levels; ++k) {
+		int end = (k < levels - 1) ? thr[k] : MXGRAY;
+		int val = k * MaxGray / (levels - 1);
+		for (; i < end; ++i) cls[i] = val;
+	}
+
+	// evaluate through the 8-bit bin of each value (lut[] for integer types)
+	const double scale = HW_pixelScale<T>();
+	HW_applyPointOp<T>(I1, I2, [&](double v) {
+		int bin = HW_histogramBin(v / scale);
+		return cls[bin] * scale;
+	});
+}
 
-	// visit all image channels and evaluate output image
-	for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {	// get input  pointer for channel ch
-		IP_getChannel(I2, ch, p2, type);		// get output pointer for channel ch
-		for (i = 0; i < total; i++) *p2++ = lut[*p1++];	// use lut[] to eval output
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_thresholdMultiOtsu:
+//
+// Split the histogram of I1 into levels classes with multi-level Otsu and
+// map class k to k*MaxGray/(levels-1). Output is in I2.
+// levels=2 gives the same result as HW_thresholdOtsu.
+//
+void
+HW_thresholdMultiOtsu(ImagePtr I1, int levels, ImagePtr I2)
+{
+	switch (HW_pixelType(I1)) {
+	case SHORT_TYPE: thresholdMultiOtsu<unsigned short>(I1, levels, I2); break;
+	case FLOAT_TYPE: thresholdMultiOtsu<float>(I1, levels, I2); break;
+	default:         thresholdMultiOtsu<uchar>(I1, levels, I2); break;
 	}
 }
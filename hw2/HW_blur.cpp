@@ -1,22 +1,21 @@
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_integral.h"
+#include "../common/HW_parallel.h"
+#include "../common/HW_pixel.h"
 using namespace IP;
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_blur:
-//
-// Blur image I1 with a box filter (unweighted averaging).
-// The filter has width filterW and height filterH.
-// We force the kernel dimensions to be odd.
-// Output is in I2.
-//
-
 int clampValue(int value, int minValue, int maxValue) {
 	if (value < minValue) return minValue;
 	if (value > maxValue) return maxValue;
 	return value;
 }
 
-void HW_blur(ImagePtr I1, int filterW, int filterH, ImagePtr I2) {
+// box filter on channels of type T; sums use the accumulator type of T and
+// the average truncates for integer types, as in the original uchar version
+template <class T>
+static void blur(ImagePtr I1, int filterW, int filterH, ImagePtr I2) {
+	typedef typename HW_PixelTraits<T>::Accum Accum;
 
 	// make sure filter dimensions are odd and positive
 	if (filterW < 1) filterW = 1;
@@ -27,25 +26,28 @@ void HW_blur(ImagePtr I1, int filterW, int filterH, ImagePtr I2) {
 	const int imageWidth = I1->width();
 	const int imageHeight = I1->height();
 	const int numChannels = I1->maxDepth();
+	const long long pixels = (long long)imageWidth * imageHeight * numChannels;
+	HW_PROFILE("HW_blur", pixels, pixels * (filterW + filterH + 2) * sizeof(T));
 
 	// prepare output image and temp image
 	IP_copyImageHeader(I1, I2);
 	ImagePtr tempImage;
 	IP_copyImageHeader(I1, tempImage);
+	HW_PROFILE_ALLOC(pixels * sizeof(T));
 
 	const int halfWidth = filterW / 2;
 	const int halfHeight = filterH / 2;
 
 	// horizontal pass
 	for (int channel = 0; channel < numChannels; ++channel) {
-		ChannelPtr<uchar> src, temp;
+		ChannelPtr<T> src, temp;
 		int type;
 		IP_getChannel(I1, channel, src, type);
 		IP_getChannel(tempImage, channel, temp, type);
 
 		for (int row = 0; row < imageHeight; ++row) {
 			for (int col = 0; col < imageWidth; ++col) {
-				int sum = 0;
+				Accum sum = 0;
 
 				// accumulate values within the horizontal filter window
 				for (int offsetX = -halfWidth; offsetX <= halfWidth; ++offsetX) {
@@ -53,21 +55,21 @@ void HW_blur(ImagePtr I1, int filterW, int filterH, ImagePtr I2) {
 					sum += src[row * imageWidth + sampleX];
 				}
 
-				temp[row * imageWidth + col] = static_cast<uchar>(sum / filterW);
+				temp[row * imageWidth + col] = static_cast<T>(sum / filterW);
 			}
 		}
 	}
 
 	// vertical pass
 	for (int channel = 0; channel < numChannels; ++channel) {
-		ChannelPtr<uchar> temp, dst;
+		ChannelPtr<T> temp, dst;
 		int type;
 		IP_getChannel(tempImage, channel, temp, type);
 		IP_getChannel(I2, channel, dst, type);
 
 		for (int row = 0; row < imageHeight; ++row) {
 			for (int col = 0; col < imageWidth; ++col) {
-				int sum = 0;
+				Accum sum = 0;
 
 				// accumulate values within the vertical filter window
 				for (int offsetY = -halfHeight; offsetY <= halfHeight; ++offsetY) {
@@ -75,8 +77,82 @@ void HW_blur(ImagePtr I1, int filterW, int filterH, ImagePtr I2) {
 					sum += temp[sampleY * imageWidth + col];
 				}
 
-				dst[row * imageWidth + col] = static_cast<uchar>(sum / filterH);
+				dst[row * imageWidth + col] = static_cast<T>(sum / filterH);
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_blur:
+//
+// Blur image I1 with a box filter (unweighted averaging).
+// The filter has width filterW and height filterH.
+// We force the kernel dimensions to be odd.
+// Output is in I2.
+//
+void HW_blur(ImagePtr I1, int filterW, int filterH, ImagePtr I2) {
+	switch (HW_pixelType(I1)) {
+	case SHORT_TYPE: blur<unsigned short>(I1, filterW, filterH, I2); break;
+	case FLOAT_TYPE: blur<float>(I1, filterW, filterH, I2); break;
+	default:         blur<uchar>(I1, filterW, filterH, I2); break;
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_blurIntegral:
+//
+// Alternate HW_blur backend built on a summed-area table (HW_IntegralImage).
+// Each output pixel is the mean of its full filterW x filterH window with the
+// same border replication, at a cost independent of the filter size.
+// The window sum is divided once instead of once per pass, so results
+// may differ from HW_blur by 1.
+// The summed-area table is 8-bit only; other pixel types use HW_blur.
+//
+void HW_blurIntegral(ImagePtr I1, int filterW, int filterH, ImagePtr I2) {
+	if (HW_pixelType(I1) != UCHAR_TYPE) {
+		HW_blur(I1, filterW, filterH, I2);
+		return;
+	}
+
+	// make sure filter dimensions are odd and positive
+	if (filterW < 1) filterW = 1;
+	if (filterH < 1) filterH = 1;
+	if ((filterW & 1) == 0) filterW++;
+	if ((filterH & 1) == 0) filterH++;
+
+	const int imageWidth = I1->width();
+	const int imageHeight = I1->height();
+	const int numChannels = I1->maxDepth();
+	const long long pixels = (long long)imageWidth * imageHeight * numChannels;
+	HW_PROFILE("HW_blurIntegral", pixels, pixels * 6);
+
+	IP_copyImageHeader(I1, I2);
+
+	const int halfWidth = filterW / 2;
+	const int halfHeight = filterH / 2;
+	const unsigned long long area = (unsigned long long)filterW * filterH;
+
+	for (int channel = 0; channel < numChannels; ++channel) {
+		ChannelPtr<uchar> src, dst;
+		int type;
+		IP_getChannel(I1, channel, src, type);
+		IP_getChannel(I2, channel, dst, type);
+
+		// table over the image padded by the filter radius
+		HW_IntegralImage table;
+		table.build(src, imageWidth, imageHeight, halfWidth, halfHeight);
+		HW_PROFILE_ALLOC((imageWidth + filterW) * (imageHeight + filterH) * sizeof(unsigned int));
+
+		uchar* out = dst;
+		HW_parallelFor(0, imageHeight, 32, [&](int rowBegin, int rowEnd) {
+			for (int row = rowBegin; row < rowEnd; ++row) {
+				for (int col = 0; col < imageWidth; ++col) {
+					unsigned long long sum = table.sum(col - halfWidth, row - halfHeight,
+					                                   col + halfWidth, row + halfHeight);
+					out[row * imageWidth + col] = static_cast<uchar>(sum / area);
+				}
+			}
+		});
+	}
+}
@@ -1,19 +1,21 @@
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_parallel.h"
+#include "../common/HW_pixel.h"
 #include <vector>
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 using namespace IP;
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_convolve:
-//
-// Convolve I1 with filter kernel in Ikernel.
-// Output is in I2.
-//
-
 // replicate-pad an input channel to a new buffer
+template <class T>
 static void makeReplicatePadded(
-    const uchar* src, int w, int h, int padX, int padY,
-    std::vector<uchar>& padded, int& pw, int& ph)
+    const T* src, int w, int h, int padX, int padY,
+    std::vector<T>& padded, int& pw, int& ph)
 {
     pw = w + 2 * padX;
     ph = h + 2 * padY;
@@ -21,14 +23,14 @@ static void makeReplicatePadded(
 
     // copy interior
     for (int y = 0; y < h; ++y) {
-        uchar* dstRow       = &padded[(y + padY) * pw + padX];
-        const uchar* srcRow = &src[y * w];
+        T* dstRow       = &padded[(y + padY) * pw + padX];
+        const T* srcRow = &src[y * w];
         std::copy(srcRow, srcRow + w, dstRow);
     }
 
     // replicate left/right borders
     for (int y = 0; y < h; ++y) {
-        uchar* row = &padded[(y + padY) * pw];
+        T* row = &padded[(y + padY) * pw];
         // left pad
         std::fill(row, row + padX, row[padX]);
         // right pad
@@ -48,7 +50,9 @@ static void makeReplicatePadded(
     }
 }
 
-void HW_convolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
+// convolution of channels of type T; sums are double for every type
+template <class T>
+static void convolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
 
     const int width       = I1->width();
     const int height      = I1->height();
@@ -60,6 +64,9 @@ void HW_convolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
     const int halfW   = kernelW / 2;
     const int halfH   = kernelH / 2;
 
+    const long long pixels = (long long)width * height * numChannels;
+    HW_PROFILE("HW_convolve", pixels, pixels * (kernelW * kernelH + 3) * sizeof(T));
+
     // get pointer to kernel data
     ChannelPtr<float> kernelData;
     int type;
@@ -70,14 +77,15 @@ void HW_convolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
 
     // convolve each channel
     for (int ch = 0; ch < numChannels; ++ch) {
-        ChannelPtr<uchar> src, dst;
+        ChannelPtr<T> src, dst;
         IP_getChannel(I1, ch, src, type);
         IP_getChannel(I2, ch, dst, type);
 
         // build a replicate-padded buffer once (follows professor's padding handout)
-        std::vector<uchar> padded;
+        std::vector<T> padded;
         int paddedW = 0, paddedH = 0;
-        makeReplicatePadded(src, width, height, halfW, halfH, padded, paddedW, paddedH);
+        makeReplicatePadded<T>(src, width, height, halfW, halfH, padded, paddedW, paddedH);
+        HW_PROFILE_ALLOC(padded.size() * sizeof(T));
 
         for (int row = 0; row < height; ++row) {
             for (int col = 0; col < width; ++col) {
@@ -91,7 +99,7 @@ void HW_convolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
                 for (int ky = -halfH; ky <= halfH; ++ky) {
                     const int py   = pcy + ky;
                     const int krow = (ky + halfH) * kernelW;
-                    const uchar* prow = &padded[py * paddedW];
+                    const T* prow = &padded[py * paddedW];
 
                     for (int kx = -halfW; kx <= halfW; ++kx) {
                         const int px = pcx + kx;
@@ -100,11 +108,294 @@ void HW_convolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
                     }
                 }
 
-                // clamp and assign to output
-                if (sum < 0.0)   sum = 0.0;
-                if (sum > 255.0) sum = 255.0;
-                dst[row * width + col] = static_cast<uchar>(sum + 0.5); // round
+                // clamp to [0, maxVal], round, and assign to output
+                dst[row * width + col] = HW_clampPixel<T>(HW_round<T>(sum));
             }
         }
     }
 }
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_convolve:
+//
+// Convolve I1 with filter kernel in Ikernel.
+// Output is in I2.
+//
+void HW_convolve(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: convolve<unsigned short>(I1, Ikernel, I2); break;
+    case FLOAT_TYPE: convolve<float>(I1, Ikernel, I2); break;
+    default:         convolve<uchar>(I1, Ikernel, I2); break;
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// separable convolution
+//
+
+// factor a kernelH x kernelW kernel as col * row (outer product);
+// false if the kernel is not of rank 1
+static bool factorKernel(const float* k, int kernelW, int kernelH,
+                         std::vector<double>& col, std::vector<double>& row) {
+    int pivot = 0;
+    for (int i = 1; i < kernelW * kernelH; ++i)
+        if (std::fabs(k[i]) > std::fabs(k[pivot])) pivot = i;
+    const double kmax = std::fabs(k[pivot]);
+    if (kmax == 0.0) return false;
+
+    const int py = pivot / kernelW, px = pivot % kernelW;
+    col.resize(kernelH);
+    row.resize(kernelW);
+    for (int y = 0; y < kernelH; ++y) col[y] = k[y * kernelW + px];
+    for (int x = 0; x < kernelW; ++x) row[x] = (double)k[py * kernelW + x] / k[pivot];
+
+    for (int y = 0; y < kernelH; ++y)
+        for (int x = 0; x < kernelW; ++x)
+            if (std::fabs(k[y * kernelW + x] - col[y] * row[x]) > 1e-6 * kmax) return false;
+    return true;
+}
+
+// separable convolution of channels of type T: rows of the padded input,
+// then columns of the row results; sums are double as in convolve<T>
+template <class T>
+static void convolveSeparable(ImagePtr I1, int kernelW, int kernelH,
+                              const std::vector<double>& col, const std::vector<double>& row, ImagePtr I2) {
+    const int width       = I1->width();
+    const int height      = I1->height();
+    const int numChannels = I1->maxDepth();
+    const long long pixels = (long long)width * height * numChannels;
+    HW_PROFILE("HW_convolveSeparable", pixels, pixels * (kernelW + kernelH + 3) * sizeof(T));
+
+    IP_copyImageHeader(I1, I2);
+
+    for (int ch = 0; ch < numChannels; ++ch) {
+        ChannelPtr<T> src, dst;
+        int type;
+        IP_getChannel(I1, ch, src, type);
+        IP_getChannel(I2, ch, dst, type);
+
+        std::vector<T> padded;
+        int paddedW = 0, paddedH = 0;
+        makeReplicatePadded<T>(src, width, height, kernelW / 2, kernelH / 2, padded, paddedW, paddedH);
+        std::vector<double> rows((size_t)paddedH * width);
+        HW_PROFILE_ALLOC(padded.size() * sizeof(T) + rows.size() * sizeof(double));
+
+        HW_parallelFor(0, paddedH, 32, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) {
+                const T* p = &padded[(size_t)y * paddedW];
+                double* r = &rows[(size_t)y * width];
+                for (int x = 0; x < width; ++x) {
+                    double sum = 0.0;
+                    for (int k = 0; k < kernelW; ++k) sum += row[k] * p[x + k];
+                    r[x] = sum;
+                }
+            }
+        });
+
+        T* out = dst;
+        HW_parallelFor(0, height, 32, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) {
+                T* o = out + (long long)y * width;
+                for (int x = 0; x < width; ++x) {
+                    double sum = 0.0;
+                    for (int k = 0; k < kernelH; ++k) sum += col[k] * rows[(size_t)(y + k) * width + x];
+                    o[x] = HW_clampPixel<T>(HW_round<T>(sum));
+                }
+            }
+        });
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_convolveSeparable:
+//
+// Alternate HW_convolve backend for kernels of rank 1 (box, binomial,
+// Gaussian, ...). The kernel is factored into a column and a row vector
+// and applied in two 1-D passes, kernelW + kernelH multiplies per pixel
+// instead of kernelW * kernelH. Summation order differs from HW_convolve,
+// so results may differ by 1. Kernels that do not factor use HW_convolve.
+//
+void HW_convolveSeparable(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
+    const int kernelW = Ikernel->width();
+    const int kernelH = Ikernel->height();
+
+    ChannelPtr<float> kernelData;
+    int type;
+    IP_getChannel(Ikernel, 0, kernelData, type);
+
+    std::vector<double> col, row;
+    if (!factorKernel(kernelData, kernelW, kernelH, col, row)) {
+        HW_convolve(I1, Ikernel, I2);
+        return;
+    }
+
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: convolveSeparable<unsigned short>(I1, kernelW, kernelH, col, row, I2); break;
+    case FLOAT_TYPE: convolveSeparable<float>(I1, kernelW, kernelH, col, row, I2); break;
+    default:         convolveSeparable<uchar>(I1, kernelW, kernelH, col, row, I2); break;
+    }
+}
+
+// true if HW_convolveSeparable can factor Ikernel
+bool HW_kernelSeparable(ImagePtr Ikernel) {
+    ChannelPtr<float> kernelData;
+    int type;
+    IP_getChannel(Ikernel, 0, kernelData, type);
+    std::vector<double> col, row;
+    return factorKernel(kernelData, Ikernel->width(), Ikernel->height(), col, row);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// fixed-point convolution
+//
+
+// quantize kernel taps to int16 with the largest shift that keeps every tap in
+// range and the int32 accumulator from overflowing; returns -1 if none does, or
+// if the taps are too coarse to guarantee results within 1 of HW_convolve
+static int quantizeKernel(const float* k, int n, std::vector<short>& taps) {
+    double maxAbs = 0.0;
+    for (int i = 0; i < n; ++i) maxAbs = std::max(maxAbs, (double)std::fabs(k[i]));
+
+    taps.resize(n);
+    for (int shift = 30; shift >= 0; --shift) {
+        const double scale = (double)(1 << shift);
+        if (maxAbs * scale > SHRT_MAX) continue;
+
+        long long absSum = 0;
+        double tapError = 0.0;
+        for (int i = 0; i < n; ++i) {
+            taps[i] = (short)std::floor(k[i] * scale + 0.5);
+            absSum += std::abs((int)taps[i]);
+            tapError += std::fabs(k[i] * scale - taps[i]);
+        }
+        // worst case |sum| plus the rounding constant
+        if (absSum * MaxGray + (1LL << shift) / 2 > INT_MAX) continue;
+
+        // worst-case deviation of the exact sum from the float one, in gray
+        // levels: below 1, the rounded results differ by at most 1
+        return (tapError * MaxGray / scale < 1.0) ? shift : -1;
+    }
+    return -1;
+}
+
+// rows [y0, y1) of one channel; KW, KH > 0 fix the kernel size at compile
+// time (the tap loops unroll), 0 takes kW, kH at run time
+template <int KW, int KH>
+static void convolveFixedRows(const uchar* padded, int pw, const short* taps, int kW, int kH,
+                              int w, int y0, int y1, int shift, uchar* dst) {
+    const int kw = KW ? KW : kW;
+    const int kh = KH ? KH : kH;
+    const int half = (1 << shift) >> 1;
+
+    for (int row = y0; row < y1; ++row) {
+        const uchar* base = padded + (long long)row * pw;
+        uchar* out = dst + (long long)row * w;
+        int col = 0;
+#if defined(__SSE2__)
+        // 8 pixels per step: pairs of taps through _mm_madd_epi16 into int32 lanes
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i rnd = _mm_set1_epi32(half);
+        for (; col + 8 <= w; col += 8) {
+            __m128i accLo = rnd, accHi = rnd;
+            for (int ky = 0; ky < kh; ++ky) {
+                const uchar* p = base + (long long)ky * pw + col;
+                const short* k = taps + ky * kw;
+                for (int kx = 0; kx < kw; kx += 2) {
+                    const short k1 = (kx + 1 < kw) ? k[kx + 1] : 0;
+                    const __m128i kk = _mm_set1_epi32((int)(unsigned short)k[kx] | ((int)k1 << 16));
+                    __m128i v0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + kx)), zero);
+                    __m128i v1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + kx + 1)), zero);
+                    accLo = _mm_add_epi32(accLo, _mm_madd_epi16(_mm_unpacklo_epi16(v0, v1), kk));
+                    accHi = _mm_add_epi32(accHi, _mm_madd_epi16(_mm_unpackhi_epi16(v0, v1), kk));
+                }
+            }
+            const __m128i sh = _mm_cvtsi32_si128(shift);
+            __m128i r = _mm_packs_epi32(_mm_sra_epi32(accLo, sh), _mm_sra_epi32(accHi, sh));
+            _mm_storel_epi64((__m128i*)(out + col), _mm_packus_epi16(r, r));
+        }
+#endif
+        for (; col < w; ++col) {
+            int acc = half;
+            for (int ky = 0; ky < kh; ++ky) {
+                const uchar* p = base + (long long)ky * pw + col;
+                const short* k = taps + ky * kw;
+                for (int kx = 0; kx < kw; ++kx) acc += k[kx] * p[kx];
+            }
+            acc >>= shift;
+            out[col] = (uchar)(acc < 0 ? 0 : (acc > MaxGray ? MaxGray : acc));
+        }
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_convolveFixed:
+//
+// Integer HW_convolve backend for 8-bit images. The float taps of Ikernel
+// are quantized to int16 with the largest common shift (up to 30 bits)
+// that keeps the worst-case sum in the int32 accumulator, so small taps
+// of large kernels keep their precision; results are then exact integer
+// arithmetic and may differ from HW_convolve by 1 through the tap
+// quantization. 3x3, 5x5 and 7x7 kernels use loops specialized at
+// compile time, other sizes a generic loop. With SSE2, 8 pixels are
+// processed per step through 16-bit multiply-adds.
+// Other pixel types, and kernels whose quantization error could reach
+// 1 gray level (HW_kernelFixedPoint() is false), use HW_convolve.
+//
+void HW_convolveFixed(ImagePtr I1, ImagePtr Ikernel, ImagePtr I2) {
+    const int kernelW = Ikernel->width();
+    const int kernelH = Ikernel->height();
+
+    ChannelPtr<float> kernelData;
+    int type;
+    IP_getChannel(Ikernel, 0, kernelData, type);
+
+    std::vector<short> taps;
+    const int shift = quantizeKernel(kernelData, kernelW * kernelH, taps);
+    if (HW_pixelType(I1) != UCHAR_TYPE || shift < 0) {
+        HW_convolve(I1, Ikernel, I2);
+        return;
+    }
+
+    const int width       = I1->width();
+    const int height      = I1->height();
+    const int numChannels = I1->maxDepth();
+    const long long pixels = (long long)width * height * numChannels;
+    HW_PROFILE("HW_convolveFixed", pixels, pixels * 3);
+
+    IP_copyImageHeader(I1, I2);
+
+    for (int ch = 0; ch < numChannels; ++ch) {
+        ChannelPtr<uchar> src, dst;
+        IP_getChannel(I1, ch, src, type);
+        IP_getChannel(I2, ch, dst, type);
+
+        std::vector<uchar> padded;
+        int paddedW = 0, paddedH = 0;
+        makeReplicatePadded<uchar>(src, width, height, kernelW / 2, kernelH / 2, padded, paddedW, paddedH);
+        padded.resize(padded.size() + 16);     // slack for the 8-byte loads of the last row
+        HW_PROFILE_ALLOC(padded.size());
+
+        const uchar* pad = &padded[0];
+        uchar* out = dst;
+        HW_parallelFor(0, height, 32, [&](int y0, int y1) {
+            const short* k = &taps[0];
+            if (kernelW == 3 && kernelH == 3)
+                convolveFixedRows<3, 3>(pad, paddedW, k, 3, 3, width, y0, y1, shift, out);
+            else if (kernelW == 5 && kernelH == 5)
+                convolveFixedRows<5, 5>(pad, paddedW, k, 5, 5, width, y0, y1, shift, out);
+            else if (kernelW == 7 && kernelH == 7)
+                convolveFixedRows<7, 7>(pad, paddedW, k, 7, 7, width, y0, y1, shift, out);
+            else
+                convolveFixedRows<0, 0>(pad, paddedW, k, kernelW, kernelH, width, y0, y1, shift, out);
+        });
+    }
+}
+
+// true if HW_convolveFixed runs Ikernel in fixed point (results within 1 of HW_convolve)
+bool HW_kernelFixedPoint(ImagePtr Ikernel) {
+    ChannelPtr<float> kernelData;
+    int type;
+    IP_getChannel(Ikernel, 0, kernelData, type);
+    std::vector<short> taps;
+    return quantizeKernel(kernelData, Ikernel->width() * Ikernel->height(), taps) >= 0;
+}
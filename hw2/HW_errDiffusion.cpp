@@ -1,7 +1,12 @@
 #include <cmath>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_parallel.h"
+#include "../common/HW_pixel.h"
 
 using namespace IP;
 
@@ -17,83 +22,66 @@ static inline uchar quantizeBW(double v) {
     return (v < 128.0) ? 0 : 255;
 }
 
-// apply gamma correction ( out = 255 * (in/255)^gamma )
-static inline short gammaCorrectU8(uchar s, double gamma) {
+// apply gamma correction ( out = 255 * (in/maxVal)^gamma ), result on the 8-bit scale
+template <class T>
+static inline short gammaCorrectPixel(T s, double gamma) {
     if (gamma <= 0.0) gamma = 1.0;
-    double lin = static_cast<double>(s) / 255.0;
+    double lin = static_cast<double>(s) / HW_PixelTraits<T>::maxVal();
     double corr = std::pow(lin, gamma);
     return static_cast<short>(std::lround(corr * 255.0));
 }
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_errDiffusion:
-//
-// Apply error diffusion algorithm to image I1.
-//
-// This procedure produces a black-and-white dithered version of I1.
-// Each pixel is visited and if it + any error that has been diffused to it
-// is greater than the threshold, the output pixel is white, otherwise it is black.
-// The difference between this new value of the pixel from what it used to be
-// (somewhere in between black and white) is diffused to the surrounding pixel
-// intensities using different weighting systems.
-//
-// Use Floyd-Steinberg     weights if method=0.
-// Use Jarvis-Judice-Ninke weights if method=1.
-//
-// Use raster scan (left-to-right) if serpentine=0.
-// Use serpentine order (alternating left-to-right and right-to-left) if serpentine=1.
-// Serpentine scan prevents errors from always being diffused in the same direction.
-//
-// A circular buffer is used to pad the edges of the image.
-// Since a pixel + its error can exceed the 255 limit of uchar, shorts are used.
-//
-// Apply gamma correction to I1 prior to error diffusion.
-// Output is saved in I2.
-//
-void HW_errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, ImagePtr I2) {
-
-    const int width = I1->width();
-    const int height = I1->height();
-    const int numChannels = I1->maxDepth();
-
-    // prepare output image
-    IP_copyImageHeader(I1, I2);
-
-    // floyd-steinberg (radius 1 horizontally and vertically)
-    struct Tap { int dx, dy; double w; };
-    std::vector<Tap> taps;
-    int padRadiusX = 0;
-    int padRadiusY = 0;
+// error weights: (dx, dy) relative to the current pixel, for a left-to-right scan
+struct Tap { int dx, dy; double w; };
 
+// weights of method; returns their horizontal reach
+static int diffusionTaps(int method, std::vector<Tap>& taps) {
     if (method == 1) {
         // jarvis-judice-ninke (normalize weights to sum = 1, denom = 48)
         // row y: (+1, 0): 7, (+2, 0): 5
         // row y+1: (-2, +1): 3, (-1, +1): 5, (0, +1): 7, (+1, +1): 5, (+2, +1): 3
         // row y+2: (-2, +2): 1, (-1, +2): 3, (0, +2): 5, (+1, +2): 3, (+2, +2): 1
-
         const double d = 48.0;
-        taps = { 
+        taps = {
             { +1,  0, 7.0 / d }, { +2,  0, 5.0 / d },
             { -2, +1, 3.0 / d }, { -1, +1, 5.0 / d }, { 0, +1, 7.0 / d }, { +1, +1, 5.0 / d }, { +2, +1, 3.0 / d },
             { -2, +2, 1.0 / d }, { -1, +2, 3.0 / d }, { 0, +2, 5.0 / d }, { +1, +2, 3.0 / d }, { +2, +2, 1.0 / d }
         };
-        padRadiusX = 2;
-        padRadiusY = 2;
-    } else {
-        // default to floyd-steinberg
-        const double d = 16.0;
-        taps = { 
-            { +1,  0, 7.0 / d },
-            { -1, +1, 3.0 / d }, { 0, +1, 5.0 / d }, { +1, +1, 1.0 / d }
-        };
-        padRadiusX = 1;
-        padRadiusY = 1; // lookahead
+        return 2;
     }
+    // default to floyd-steinberg
+    const double d = 16.0;
+    taps = {
+        { +1,  0, 7.0 / d },
+        { -1, +1, 3.0 / d }, { 0, +1, 5.0 / d }, { +1, +1, 1.0 / d }
+    };
+    return 1;
+}
+
+// error diffusion of channels of type T; errors are diffused on the 8-bit
+// scale and the black/white output is written as 0 or maxVal of T
+template <class T>
+static void errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, ImagePtr I2) {
+
+    const int width = I1->width();
+    const int height = I1->height();
+    const int numChannels = I1->maxDepth();
+    const long long pixels = (long long)width * height * numChannels;
+    HW_PROFILE("HW_errDiffusion", pixels, 2 * pixels);
+
+    // prepare output image
+    IP_copyImageHeader(I1, I2);
+
+    // floyd-steinberg (radius 1 horizontally and vertically) or
+    // jarvis-judice-ninke (radius 2)
+    std::vector<Tap> taps;
+    const int padRadiusX = diffusionTaps(method, taps);
 
     // 3 row circular buffer, each row buffer length = width + 2 * padRadiusX
     const int paddedWidth = width + 2 * padRadiusX;
     const int bufferRows = 3;
     std::vector<short> rowBuf(bufferRows * paddedWidth, 0);
+    HW_PROFILE_ALLOC(rowBuf.size() * sizeof(short));
 
     // helper to index circular rows
     auto rowIndex = [&](int r)->short* { return &rowBuf[(r % bufferRows) * paddedWidth]; };
@@ -103,9 +91,12 @@ void HW_errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, Ima
         return rightToLeft ? -dx : dx;
     };
 
+    // native value of white
+    const double outScale = HW_pixelScale<T>();
+
     // process each channel
     for (int ch = 0; ch < numChannels; ++ch) {
-        ChannelPtr<uchar> src, dst;
+        ChannelPtr<T> src, dst;
         int type;
         IP_getChannel(I1, ch, src, type);
         IP_getChannel(I2, ch, dst, type);
@@ -117,7 +108,7 @@ void HW_errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, Ima
             if (imgY < 0 || imgY >= height) return; // out of bounds
             // fill center part with gamma corrected input
             for (int x = 0; x < width; ++x) {
-                bufRow[padRadiusX + x] = gammaCorrectU8(src[imgY * width + x], gamma);
+                bufRow[padRadiusX + x] = gammaCorrectPixel<T>(src[imgY * width + x], gamma);
             }
         };
 
@@ -137,7 +128,7 @@ void HW_errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, Ima
                     const int px = padRadiusX + x;
                     double val = static_cast<double>(currRow[px]);
                     uchar out = quantizeBW(val);
-                    dst[y * width + x] = out;
+                    dst[y * width + x] = static_cast<T>(out * outScale);
 
                     // error to diffuse
                     double err = val - static_cast<double>(out);
@@ -165,7 +156,7 @@ void HW_errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, Ima
                     const int px = padRadiusX + x;
                     double val = static_cast<double>(currRow[px]);
                     uchar out = quantizeBW(val);
-                    dst[y * width + x] = out;
+                    dst[y * width + x] = static_cast<T>(out * outScale);
 
                     double err = val - static_cast<double>(out);
 
@@ -192,3 +183,145 @@ void HW_errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, Ima
         }
     }
 }
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_errDiffusion:
+//
+// Apply error diffusion algorithm to image I1.
+//
+// This procedure produces a black-and-white dithered version of I1.
+// Each pixel is visited and if it + any error that has been diffused to it
+// is greater than the threshold, the output pixel is white, otherwise it is black.
+// The difference between this new value of the pixel from what it used to be
+// (somewhere in between black and white) is diffused to the surrounding pixel
+// intensities using different weighting systems.
+//
+// Use Floyd-Steinberg     weights if method=0.
+// Use Jarvis-Judice-Ninke weights if method=1.
+//
+// Use raster scan (left-to-right) if serpentine=0.
+// Use serpentine order (alternating left-to-right and right-to-left) if serpentine=1.
+// Serpentine scan prevents errors from always being diffused in the same direction.
+//
+// A circular buffer is used to pad the edges of the image.
+// Since a pixel + its error can exceed the 255 limit of uchar, shorts are used.
+//
+// Apply gamma correction to I1 prior to error diffusion.
+// Output is saved in I2.
+//
+void HW_errDiffusion(ImagePtr I1, int method, bool serpentine, double gamma, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: errDiffusion<unsigned short>(I1, method, serpentine, gamma, I2); break;
+    case FLOAT_TYPE: errDiffusion<float>(I1, method, serpentine, gamma, I2); break;
+    default:         errDiffusion<uchar>(I1, method, serpentine, gamma, I2); break;
+    }
+}
+
+// raster-order error diffusion of channels of type T with rows on
+// concurrent threads; same arithmetic as errDiffusion<T>
+template <class T>
+static void errDiffusionWavefront(ImagePtr I1, int method, double gamma, int threads, ImagePtr I2) {
+    const int width = I1->width();
+    const int height = I1->height();
+    const int numChannels = I1->maxDepth();
+    const long long pixels = (long long)width * height * numChannels;
+    HW_PROFILE("HW_errDiffusionWavefront", pixels, 4 * pixels);
+    HW_PROFILE_THREADS(threads);
+
+    IP_copyImageHeader(I1, I2);
+
+    std::vector<Tap> taps;
+    const int reach = diffusionTaps(method, taps);
+
+    // all rows are buffered (plus two that receive the errors of the last rows)
+    const int paddedWidth = width + 2 * reach;
+    std::vector<short> buf((size_t)(height + 2) * paddedWidth);
+    std::vector<std::atomic<int>> done(height);        // pixels finished per row
+    HW_PROFILE_ALLOC(buf.size() * sizeof(short) + done.size() * sizeof(int));
+
+    // a row may process pixel x once the row above is 2 * reach + 1 pixels ahead:
+    // then every error for x has arrived, and the two rows write disjoint pixels
+    const int lag = 2 * reach + 1;
+    const double outScale = HW_pixelScale<T>();
+
+    for (int ch = 0; ch < numChannels; ++ch) {
+        ChannelPtr<T> src, dst;
+        int type;
+        IP_getChannel(I1, ch, src, type);
+        IP_getChannel(I2, ch, dst, type);
+
+        std::fill(buf.begin(), buf.end(), 0);
+        HW_parallelFor(0, height, 64, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) {
+                short* row = &buf[(size_t)y * paddedWidth + reach];
+                for (int x = 0; x < width; ++x) row[x] = gammaCorrectPixel<T>(src[y * width + x], gamma);
+            }
+        });
+        for (int y = 0; y < height; ++y) done[y].store(0, std::memory_order_relaxed);
+
+        // thread k diffuses rows k, k + threads, ...
+        auto rows = [&](int k) {
+            for (int y = k; y < height; y += threads) {
+                short* rowBuf[3];
+                for (int r = 0; r < 3; ++r) rowBuf[r] = &buf[(size_t)(y + r) * paddedWidth];
+                int above = (y == 0) ? width : done[y - 1].load(std::memory_order_acquire);
+
+                for (int x = 0; x < width; ++x) {
+                    const int need = std::min(x + lag, width);
+                    while (above < need) {
+                        std::this_thread::yield();
+                        above = done[y - 1].load(std::memory_order_acquire);
+                    }
+
+                    const int px = reach + x;
+                    double val = static_cast<double>(rowBuf[0][px]);
+                    uchar out = quantizeBW(val);
+                    dst[y * width + x] = static_cast<T>(out * outScale);
+
+                    double err = val - static_cast<double>(out);
+                    for (const auto& t : taps) {
+                        const int tx = px + t.dx;
+                        if (tx < 0 || tx >= paddedWidth) continue;
+                        short* target = rowBuf[t.dy];
+                        int tmp = static_cast<int>(target[tx]) + static_cast<int>(std::lround(err * t.w));
+                        if (tmp < -32768) tmp = -32768;
+                        if (tmp > 32767) tmp = 32767;
+                        target[tx] = static_cast<short>(tmp);
+                    }
+                    if ((x & 15) == 15) done[y].store(x + 1, std::memory_order_release);
+                }
+                done[y].store(width, std::memory_order_release);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (int k = 1; k < threads; ++k) workers.emplace_back(rows, k);
+        rows(0);
+        for (std::thread& t : workers) t.join();
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_errDiffusionWavefront:
+//
+// Alternate HW_errDiffusion backend that diffuses several rows at once.
+// Row y runs on its own thread and trails row y-1 by 2 * reach + 1 pixels
+// (3 for Floyd-Steinberg, 5 for Jarvis-Judice-Ninke), so every error has
+// arrived before a pixel is quantized; the output is identical to
+// HW_errDiffusion. The whole channel is buffered (2 bytes per pixel).
+// Serpentine scans need all of the row above before a right-to-left row can
+// start and use HW_errDiffusion, as do single-threaded runs.
+//
+void HW_errDiffusionWavefront(ImagePtr I1, int method, bool serpentine, double gamma, ImagePtr I2) {
+    const int threads = std::min(HW_threadCount(), (int)I1->height());
+    if (serpentine || threads < 2) {
+        HW_errDiffusion(I1, method, serpentine, gamma, I2);
+        return;
+    }
+
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: errDiffusionWavefront<unsigned short>(I1, method, gamma, threads, I2); break;
+    case FLOAT_TYPE: errDiffusionWavefront<float>(I1, method, gamma, threads, I2); break;
+    default:         errDiffusionWavefront<uchar>(I1, method, gamma, threads, I2); break;
+    }
+}
@@ -1,17 +1,14 @@
 #include <algorithm>
 #include <vector>
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_pixel.h"
 using namespace IP;
 using std::vector;
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_median:
-//
-// Apply median filter of size sz x sz to I1.
-// Clamp sz to 9.
-// Output is in I2.
-//
-void HW_median(ImagePtr I1, int sz, ImagePtr I2) {
+// median filter on channels of type T
+template <class T>
+static void median(ImagePtr I1, int sz, ImagePtr I2) {
 
     // ensure valid filter size
     if (sz < 1) sz = 1;
@@ -21,6 +18,8 @@ void HW_median(ImagePtr I1, int sz, ImagePtr I2) {
     const int width = I1->width();
     const int height = I1->height();
     const int numChannels = I1->maxDepth();
+    const long long pixels = (long long)width * height * numChannels;
+    HW_PROFILE("HW_median", pixels, pixels * (sz * sz + 1) * sizeof(T));
 
     // prepare output image
     IP_copyImageHeader(I1, I2);
@@ -30,12 +29,13 @@ void HW_median(ImagePtr I1, int sz, ImagePtr I2) {
 
     // apply median filter to each channel
     for (int ch = 0; ch < numChannels; ++ch) {
-        ChannelPtr<uchar> src, dst;
+        ChannelPtr<T> src, dst;
         int type;
         IP_getChannel(I1, ch, src, type);
         IP_getChannel(I2, ch, dst, type);
 
-        std::vector<uchar> neighborhood(windowArea);
+        std::vector<T> neighborhood(windowArea);
+        HW_PROFILE_ALLOC(windowArea * sizeof(T));
 
         for (int row = 0; row < height; ++row) {
             for (int col = 0; col < width; ++col) {
@@ -62,3 +62,18 @@ void HW_median(ImagePtr I1, int sz, ImagePtr I2) {
         }
     }
 }
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_median:
+//
+// Apply median filter of size sz x sz to I1.
+// Clamp sz to 9.
+// Output is in I2.
+//
+void HW_median(ImagePtr I1, int sz, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: median<unsigned short>(I1, sz, I2); break;
+    case FLOAT_TYPE: median<float>(I1, sz, I2); break;
+    default:         median<uchar>(I1, sz, I2); break;
+    }
+}
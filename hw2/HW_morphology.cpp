@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <vector>
+#include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_parallel.h"
+#include "../common/HW_pixel.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace IP;
+using std::vector;
+
+// min (erosion) and max (dilation) of single values and of whole rows
+template <class T>
+struct MinOp {
+    static T apply(T a, T b) { return (b < a) ? b : a; }
+    static void row(const T* a, const T* b, T* out, int n) {
+        for (int i = 0; i < n; ++i) out[i] = apply(a[i], b[i]);
+    }
+};
+
+template <class T>
+struct MaxOp {
+    static T apply(T a, T b) { return (a < b) ? b : a; }
+    static void row(const T* a, const T* b, T* out, int n) {
+        for (int i = 0; i < n; ++i) out[i] = apply(a[i], b[i]);
+    }
+};
+
+#if defined(__SSE2__)
+// 16 pixels per instruction for 8-bit rows
+template <>
+void MinOp<uchar>::row(const uchar* a, const uchar* b, uchar* out, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_min_epu8(va, vb));
+    }
+    for (; i < n; ++i) out[i] = apply(a[i], b[i]);
+}
+
+template <>
+void MaxOp<uchar>::row(const uchar* a, const uchar* b, uchar* out, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_max_epu8(va, vb));
+    }
+    for (; i < n; ++i) out[i] = apply(a[i], b[i]);
+}
+#endif
+
+// padded length of a line of n samples for window k: n + k - 1 rounded up to a multiple of k
+static int paddedLength(int n, int k) {
+    int m = n + k - 1;
+    return (m + k - 1) / k * k;
+}
+
+// van Herk/Gil-Werman along one row: dst[x] = op over src[x-r .. x+r], borders replicated.
+// g holds running values from the start of each block of k samples, h from its end,
+// and every window of k samples spans the end of one block and the start of the next.
+template <class T, class Op>
+static void vhgwRow(const T* src, int n, int k, T* dst, T* a, T* g, T* h) {
+    const int r = k / 2;
+    const int M = paddedLength(n, k);
+
+    for (int i = 0; i < M; ++i) {
+        int x = i - r;
+        a[i] = src[x < 0 ? 0 : (x >= n ? n - 1 : x)];
+    }
+    for (int b = 0; b < M; b += k) {
+        g[b] = a[b];
+        for (int i = b + 1; i < b + k; ++i) g[i] = Op::apply(g[i - 1], a[i]);
+        h[b + k - 1] = a[b + k - 1];
+        for (int i = b + k - 2; i >= b; --i) h[i] = Op::apply(h[i + 1], a[i]);
+    }
+    for (int x = 0; x < n; ++x) dst[x] = Op::apply(h[x], g[x + k - 1]);
+}
+
+// the same algorithm down the columns [x0, x0+cols) of an image, one row of
+// the strip at a time, so that every step is a vectorized row operation
+template <class T, class Op>
+static void vhgwColumns(const T* src, int width, int height, int x0, int cols, int k, T* dst,
+                        vector<T>& g, vector<T>& h) {
+    const int r = k / 2;
+    const int M = paddedLength(height, k);
+    auto row = [&](int i) {
+        int y = i - r;
+        y = (y < 0) ? 0 : (y >= height ? height - 1 : y);
+        return src + (long long)y * width + x0;
+    };
+
+    g.resize((size_t)M * cols);
+    h.resize((size_t)M * cols);
+    for (int i = 0; i < M; ++i) {
+        T* gi = &g[(size_t)i * cols];
+        if (i % k == 0) std::copy(row(i), row(i) + cols, gi);
+        else Op::row(gi - cols, row(i), gi, cols);
+    }
+    for (int i = M - 1; i >= 0; --i) {
+        T* hi = &h[(size_t)i * cols];
+        if (i % k == k - 1) std::copy(row(i), row(i) + cols, hi);
+        else Op::row(hi + cols, row(i), hi, cols);
+    }
+    for (int y = 0; y < height; ++y)
+        Op::row(&h[(size_t)y * cols], &g[(size_t)(y + k - 1) * cols], dst + (long long)y * width + x0, cols);
+}
+
+// separable erosion (MinOp) or dilation (MaxOp) with a sizeW x sizeH rectangle
+template <class T, class Op>
+static void morph(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2) {
+    const int width = I1->width();
+    const int height = I1->height();
+    const int numChannels = I1->maxDepth();
+
+    IP_copyImageHeader(I1, I2);
+    ImagePtr tempImage;
+    IP_copyImageHeader(I1, tempImage);
+    HW_PROFILE_ALLOC((long long)width * height * numChannels * sizeof(T));
+
+    for (int ch = 0; ch < numChannels; ++ch) {
+        ChannelPtr<T> src, temp, dst;
+        int type;
+        IP_getChannel(I1, ch, src, type);
+        IP_getChannel(tempImage, ch, temp, type);
+        IP_getChannel(I2, ch, dst, type);
+        const T* in = src;
+        T* mid = temp;
+        T* out = dst;
+
+        // horizontal pass, row bands in parallel
+        HW_parallelFor(0, height, 64, [&](int y0, int y1) {
+            const int M = paddedLength(width, sizeW);
+            vector<T> a(M), g(M), h(M);
+            for (int y = y0; y < y1; ++y)
+                vhgwRow<T, Op>(in + (long long)y * width, width, sizeW, mid + (long long)y * width,
+                               &a[0], &g[0], &h[0]);
+        });
+
+        // vertical pass, column strips in parallel
+        const int stripCols = 256;
+        const int strips = (width + stripCols - 1) / stripCols;
+        HW_parallelFor(0, strips, 1, [&](int s0, int s1) {
+            vector<T> g, h;
+            for (int s = s0; s < s1; ++s) {
+                const int x0 = s * stripCols;
+                const int cols = std::min(stripCols, width - x0);
+                vhgwColumns<T, Op>(mid, width, height, x0, cols, sizeH, out, g, h);
+            }
+        });
+    }
+}
+
+// make sure structuring element dimensions are odd and positive
+static void oddSize(int& sizeW, int& sizeH) {
+    if (sizeW < 1) sizeW = 1;
+    if (sizeH < 1) sizeH = 1;
+    if ((sizeW & 1) == 0) sizeW++;
+    if ((sizeH & 1) == 0) sizeH++;
+}
+
+// morphology operations on channels of type T
+enum { ERODE, DILATE, OPEN, CLOSE, TOPHAT };
+
+template <class T>
+static void morphology(ImagePtr I1, int op, int sizeW, int sizeH, ImagePtr I2) {
+    oddSize(sizeW, sizeH);
+
+    const long long pixels = (long long)I1->width() * I1->height() * I1->maxDepth();
+    const int passes = (op == ERODE || op == DILATE) ? 1 : 2;
+    HW_PROFILE(op == ERODE ? "HW_erode" : op == DILATE ? "HW_dilate" : op == OPEN ? "HW_open" :
+               op == CLOSE ? "HW_close" : "HW_tophat",
+               pixels * passes, pixels * passes * 4 * sizeof(T));
+
+    switch (op) {
+    case ERODE:  morph<T, MinOp<T>>(I1, sizeW, sizeH, I2); return;
+    case DILATE: morph<T, MaxOp<T>>(I1, sizeW, sizeH, I2); return;
+    default:     break;
+    }
+
+    ImagePtr tempImage;
+    if (op == CLOSE) {
+        morph<T, MaxOp<T>>(I1, sizeW, sizeH, tempImage);
+        morph<T, MinOp<T>>(tempImage, sizeW, sizeH, I2);
+        return;
+    }
+    morph<T, MinOp<T>>(I1, sizeW, sizeH, tempImage);
+    morph<T, MaxOp<T>>(tempImage, sizeW, sizeH, I2);
+    if (op == OPEN) return;
+
+    // top-hat: input minus its opening (never negative, since opening <= input)
+    const int total = I1->width() * I1->height();
+    ChannelPtr<T> src, dst;
+    int type;
+    for (int ch = 0; IP_getChannel(I1, ch, src, type); ch++) {
+        IP_getChannel(I2, ch, dst, type);
+        for (int i = 0; i < total; ++i) dst[i] = src[i] - dst[i];
+    }
+}
+
+static void morphology(ImagePtr I1, int op, int sizeW, int sizeH, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: morphology<unsigned short>(I1, op, sizeW, sizeH, I2); break;
+    case FLOAT_TYPE: morphology<float>(I1, op, sizeW, sizeH, I2); break;
+    default:         morphology<uchar>(I1, op, sizeW, sizeH, I2); break;
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_erode:
+//
+// Grayscale erosion of I1 with a sizeW x sizeH rectangle (minimum over
+// the window). We force the dimensions to be odd. Output is in I2.
+//
+// Rows and then columns are filtered with the van Herk/Gil-Werman
+// algorithm: about 3 min operations per pixel and pass, regardless of
+// the window size. The column pass works on whole rows of a strip (SSE2
+// byte min/max for 8-bit images). Borders are replicated as in HW_median.
+//
+void HW_erode(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2) {
+    morphology(I1, ERODE, sizeW, sizeH, I2);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_dilate:
+//
+// Grayscale dilation of I1 (maximum over the sizeW x sizeH window), as HW_erode.
+//
+void HW_dilate(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2) {
+    morphology(I1, DILATE, sizeW, sizeH, I2);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_open:
+//
+// Opening of I1: erosion followed by dilation. Removes bright details
+// smaller than the window.
+//
+void HW_open(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2) {
+    morphology(I1, OPEN, sizeW, sizeH, I2);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_close:
+//
+// Closing of I1: dilation followed by erosion. Fills dark details
+// smaller than the window.
+//
+void HW_close(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2) {
+    morphology(I1, CLOSE, sizeW, sizeH, I2);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_tophat:
+//
+// White top-hat of I1: I1 minus its opening. Keeps the bright details
+// smaller than the window (e.g. text on an uneven background).
+//
+void HW_tophat(ImagePtr I1, int sizeW, int sizeH, ImagePtr I2) {
+    morphology(I1, TOPHAT, sizeW, sizeH, I2);
+}
@@ -0,0 +1,238 @@
+#include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_parallel.h"
+#include "../common/HW_pixel.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace IP;
+
+// resampling weights along one axis: output sample i reads the taps source
+// samples index[i*taps + k] with weight[i*taps + k] (indices already clamped)
+struct ResizeCoeffs {
+    int taps;
+    std::vector<int>   index;
+    std::vector<float> weight;
+};
+
+static inline int clampIndex(int v, int n) {
+    return (v < 0) ? 0 : (v >= n ? n - 1 : v);
+}
+
+// Keys cubic convolution kernel with a = -0.5 (Catmull-Rom)
+static double cubicWeight(double x) {
+    x = std::fabs(x);
+    if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;
+    if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+    return 0.0;
+}
+
+// weights mapping src samples to dst samples for method 0 (area), 1 (bilinear) or 2 (bicubic)
+static ResizeCoeffs makeCoeffs(int src, int dst, int method) {
+    const double scale = (double)src / dst;
+    ResizeCoeffs c;
+    c.taps = (method == 0) ? (int)std::ceil(scale) + 1 : (method == 1) ? 2 : 4;
+    c.index.resize((size_t)dst * c.taps);
+    c.weight.resize((size_t)dst * c.taps);
+
+    std::vector<double> w(c.taps);
+    for (int i = 0; i < dst; ++i) {
+        int first;
+        if (method == 0) {
+            // overlap of source pixel s with the footprint [a,b) of output pixel i
+            const double a = i * scale, b = a + scale;
+            first = (int)std::floor(a);
+            for (int k = 0; k < c.taps; ++k) {
+                const double overlap = std::min(b, first + k + 1.0) - std::max(a, (double)(first + k));
+                w[k] = (overlap > 0.0) ? overlap : 0.0;
+            }
+        }
+        else {
+            // pixel centers aligned: output i sits at source position (i + 0.5) * scale - 0.5
+            const double x = (i + 0.5) * scale - 0.5;
+            const int x0 = (int)std::floor(x);
+            const double t = x - x0;
+            if (method == 1) {
+                first = x0;
+                w[0] = 1.0 - t;
+                w[1] = t;
+            }
+            else {
+                first = x0 - 1;
+                for (int k = 0; k < 4; ++k) w[k] = cubicWeight(t + 1.0 - k);
+            }
+        }
+
+        double sum = 0.0;
+        for (int k = 0; k < c.taps; ++k) sum += w[k];
+        for (int k = 0; k < c.taps; ++k) {
+            c.index [(size_t)i * c.taps + k] = clampIndex(first + k, src);
+            c.weight[(size_t)i * c.taps + k] = (float)(w[k] / sum);
+        }
+    }
+    return c;
+}
+
+// line[x] = sum over k of w[k] * rows[k][x], x in [0,width)
+template <class T>
+static void weightRows(const T* const* rows, const float* w, int taps, int width, float* line) {
+    for (int x = 0; x < width; ++x) {
+        float s = 0.0f;
+        for (int k = 0; k < taps; ++k) s += w[k] * rows[k][x];
+        line[x] = s;
+    }
+}
+
+static void weightRows(const uchar* const* rows, const float* w, int taps, int width, float* line) {
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        __m128 acc[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        for (int k = 0; k < taps; ++k) {
+            const __m128i in = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+            const __m128i lo = _mm_unpacklo_epi8(in, zero), hi = _mm_unpackhi_epi8(in, zero);
+            const __m128i q[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                                   _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+            const __m128 wk = _mm_set1_ps(w[k]);
+            for (int j = 0; j < 4; ++j) acc[j] = _mm_add_ps(acc[j], _mm_mul_ps(_mm_cvtepi32_ps(q[j]), wk));
+        }
+        for (int j = 0; j < 4; ++j) _mm_storeu_ps(line + x + 4 * j, acc[j]);
+    }
+#endif
+    for (; x < width; ++x) {
+        float s = 0.0f;
+        for (int k = 0; k < taps; ++k) s += w[k] * rows[k][x];
+        line[x] = s;
+    }
+}
+
+// separable resampling of one channel with coefficient tables cx, cy
+template <class T>
+static void resampleChannel(const T* src, int sw, T* dst, int dw, int dh,
+                            const ResizeCoeffs& cx, const ResizeCoeffs& cy) {
+    HW_parallelFor(0, dh, 16, [&](int y0, int y1) {
+        std::vector<float> line(sw);
+        std::vector<const T*> rows(cy.taps);
+        for (int y = y0; y < y1; ++y) {
+            // vertical pass over full source rows, then horizontal taps
+            for (int k = 0; k < cy.taps; ++k) rows[k] = src + (long long)cy.index[(size_t)y * cy.taps + k] * sw;
+            weightRows(&rows[0], &cy.weight[(size_t)y * cy.taps], cy.taps, sw, &line[0]);
+
+            T* out = dst + (long long)y * dw;
+            const int*   ix = &cx.index[0];
+            const float* wx = &cx.weight[0];
+            for (int x = 0; x < dw; ++x, ix += cx.taps, wx += cx.taps) {
+                float s = 0.0f;
+                for (int k = 0; k < cx.taps; ++k) s += wx[k] * line[ix[k]];
+                out[x] = HW_clampPixel<T>(HW_PixelTraits<T>::isInteger ? s + 0.5f : s);
+            }
+        }
+    });
+}
+
+// v[x] += r[x], x in [0,width)
+static void addRow(const uchar* r, int width, unsigned short* v) {
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        const __m128i in = _mm_loadu_si128((const __m128i*)(r + x));
+        __m128i* p = (__m128i*)(v + x);
+        _mm_storeu_si128(p,     _mm_add_epi16(_mm_loadu_si128(p),     _mm_unpacklo_epi8(in, zero)));
+        _mm_storeu_si128(p + 1, _mm_add_epi16(_mm_loadu_si128(p + 1), _mm_unpackhi_epi8(in, zero)));
+    }
+#endif
+    for (; x < width; ++x) v[x] += r[x];
+}
+
+// area averaging by integer factors fx x fy (fy <= 257, so column sums fit 16 bits):
+// box sums of the fy rows of each output row, then of fx columns, rounded
+static void boxReduceChannel(const uchar* src, int sw, uchar* dst, int dw, int dh, int fx, int fy) {
+    const int area = fx * fy;
+    HW_parallelFor(0, dh, 16, [&](int y0, int y1) {
+        std::vector<unsigned short> line(sw);
+        for (int y = y0; y < y1; ++y) {
+            std::fill(line.begin(), line.end(), 0);
+            for (int k = 0; k < fy; ++k) addRow(src + ((long long)y * fy + k) * sw, sw, &line[0]);
+
+            uchar* out = dst + (long long)y * dw;
+            const unsigned short* v = &line[0];
+            for (int x = 0; x < dw; ++x, v += fx) {
+                int s = 0;
+                for (int k = 0; k < fx; ++k) s += v[k];
+                out[x] = (uchar)((s + area / 2) / area);
+            }
+        }
+    });
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_resize:
+//
+// Resize image I1 to w x h. If one of w, h is 0 it follows from the other
+// with the aspect ratio of I1.
+// method=0: area averaging; each output pixel is the mean of the source
+//           area it covers. Integer reduction factors are plain box
+//           averages. Use it to downscale.
+// method=1: bilinear interpolation.
+// method=2: bicubic interpolation (Catmull-Rom); values are clamped.
+// The filter is separable, with the weights of each output row and column
+// tabulated once; borders are replicated. Output rows are built in
+// parallel from one vertical pass over the source rows (SSE2 for 8-bit
+// images) and one horizontal pass.
+// 8-bit and single-channel float images are resized; other layouts
+// (16-bit, multi-channel float) cannot be allocated at the new size and
+// are rejected with a message, leaving I2 unchanged.
+// Output is in I2.
+//
+void HW_resize(ImagePtr I1, int w, int h, int method, ImagePtr I2) {
+    const int sw = I1->width(), sh = I1->height();
+    if (w <= 0 && h <= 0) { w = sw; h = sh; }
+    else if (w <= 0) w = std::max(1, (int)((double)sw * h / sh + 0.5));
+    else if (h <= 0) h = std::max(1, (int)((double)sh * w / sw + 0.5));
+    if (method < 0 || method > 2) method = 1;
+
+    const int numChannels = I1->maxDepth();
+    const int pixelType = HW_pixelType(I1);
+    if (pixelType != UCHAR_TYPE && !(pixelType == FLOAT_TYPE && numChannels == 1)) {
+        fprintf(stderr, "HW_resize: cannot resize %d-channel %s images\n", numChannels,
+                pixelType == SHORT_TYPE ? "16-bit" : "float");
+        return;
+    }
+
+    const long long pixels = (long long)w * h * numChannels;
+    HW_PROFILE("HW_resize", pixels, ((long long)sw * sh * numChannels + pixels) * ((pixelType == UCHAR_TYPE) ? 1 : 4));
+
+    if (pixelType == FLOAT_TYPE) {
+        IP_copyImageHeader(IP_allocImage(w, h, FLOATCH_TYPE), I2);
+        const ResizeCoeffs cx = makeCoeffs(sw, w, method), cy = makeCoeffs(sh, h, method);
+        ChannelPtr<float> p1, p2;
+        int type;
+        IP_getChannel(I1, 0, p1, type);
+        IP_getChannel(I2, 0, p2, type);
+        resampleChannel<float>(p1, sw, p2, w, h, cx, cy);
+        return;
+    }
+
+    IP_copyImageHeader(IP_allocImage(w, h, (numChannels == 1) ? BW_IMAGE : RGB_IMAGE), I2);
+
+    const bool box = (method == 0 && sw % w == 0 && sh % h == 0 && sh / h <= 257);
+    ResizeCoeffs cx, cy;
+    if (!box) {
+        cx = makeCoeffs(sw, w, method);
+        cy = makeCoeffs(sh, h, method);
+    }
+
+    ChannelPtr<uchar> p1, p2;
+    int type;
+    for (int ch = 0; IP_getChannel(I1, ch, p1, type); ch++) {
+        IP_getChannel(I2, ch, p2, type);
+        if (box) boxReduceChannel(p1, sw, p2, w, h, sw / w, sh / h);
+        else     resampleChannel<uchar>(p1, sw, p2, w, h, cx, cy);
+    }
+}
@@ -1,19 +1,17 @@
 #include "IP.h"
+#include "../common/HW_instrument.h"
+#include "../common/HW_pixel.h"
 using namespace IP;
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// HW_sharpen:
-//
-// Sharpen image I1. Output is in I2.
-//
-
-static inline uchar clipToByte(double v) {
-    if (v < 0.0) return 0;
-    if (v > 255.0) return 255;
-    return static_cast<uchar>(v + 0.5); // round
+// clip to [0, maxVal] and round for integer types
+template <class T>
+static inline T clipToPixel(double v) {
+    return HW_clampPixel<T>(HW_round<T>(v));
 }
 
-void HW_sharpen(ImagePtr I1, int size, double factor, ImagePtr I2) {
+// unsharp masking on channels of type T
+template <class T>
+static void sharpen(ImagePtr I1, int size, double factor, ImagePtr I2) {
 
     // make sure filter size is odd 
     if (size < 1) size = 1;
@@ -22,17 +20,20 @@ void HW_sharpen(ImagePtr I1, int size, double factor, ImagePtr I2) {
     const int width = I1->width();
     const int height = I1->height();
     const int numChannels = I1->maxDepth();
+    const long long pixels = (long long)width * height * numChannels;
+    HW_PROFILE("HW_sharpen", pixels, 3 * pixels * sizeof(T));
 
     // create blurred image using size x size box filter
     ImagePtr blurred;
     HW_blur(I1, size, size, blurred);
+    HW_PROFILE_ALLOC(pixels * sizeof(T));
 
     // prepare output image
     IP_copyImageHeader(I1, I2);
 
     // sharpen for each channel, then clip
     for (int ch = 0; ch < numChannels; ++ch) {
-        ChannelPtr<uchar> src, blur, dst;
+        ChannelPtr<T> src, blur, dst;
         int type;
         IP_getChannel(I1, ch, src, type);
         IP_getChannel(blurred, ch, blur, type);
@@ -45,8 +46,21 @@ void HW_sharpen(ImagePtr I1, int size, double factor, ImagePtr I2) {
                 const double s = static_cast<double>(src[idx]);
                 const double b = static_cast<double>(blur[idx]);
                 const double out = s + factor * (s - b); // unsharp mask
-                dst[idx] = clipToByte(out); // clip to [0, 255]
+                dst[idx] = clipToPixel<T>(out); // clip to [0, maxVal]
             }
         }
     }
 }
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// HW_sharpen:
+//
+// Sharpen image I1. Output is in I2.
+//
+void HW_sharpen(ImagePtr I1, int size, double factor, ImagePtr I2) {
+    switch (HW_pixelType(I1)) {
+    case SHORT_TYPE: sharpen<unsigned short>(I1, size, factor, I2); break;
+    case FLOAT_TYPE: sharpen<float>(I1, size, factor, I2); break;
+    default:         sharpen<uchar>(I1, size, factor, I2); break;
+    }
+}
@@ -0,0 +1,36 @@
+#include "IP.h"
+#include "../common/HW_golden.h"
+#include <cstdio>
+#include <cstring>
+using namespace IP;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// hwgolden:
+//
+// Verify the HW_* operators and their registered variants against the
+// golden outputs committed in golden/, or regenerate them:
+//   hwgolden verify [dir]     (default dir: golden)
+//   hwgolden record [dir]
+// The committed outputs were recorded with the baseline scalar operators
+// (operators added since then with their first implementation). Record
+// again only for an intended change of reference behavior, and commit
+// the new outputs with that change.
+// Exits with the number of failed cases (0 on success).
+//
+int main(int argc, char** argv) {
+    const char* dir = (argc > 2) ? argv[2] : "golden";
+    if (argc < 2 || (strcmp(argv[1], "verify") && strcmp(argv[1], "record"))) {
+        fprintf(stderr, "usage: %s verify|record [dir]\n", argv[0]);
+        return 2;
+    }
+
+    if (!strcmp(argv[1], "record")) {
+        const int failures = HW_goldenRecord(dir);
+        fprintf(stderr, "%s: recorded into %s (%d failures)\n", argv[0], dir, failures);
+        return failures;
+    }
+
+    const int failures = HW_goldenVerify(dir);
+    fprintf(stderr, "%s: %s: %d failures\n", argv[0], dir, failures);
+    return failures;
+}